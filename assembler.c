@@ -1,25 +1,58 @@
 /**
  * Implementation of the assembler module.
  * This module is responsible for assembling the source code into opcodes instruction by instruction.
+ * Lines after a .data directive are laid out into the data segment instead, which is allocated once
+ * its size is known and filled in place, so it can be mapped into guest memory without a copy.
+ * In lazy mode only the layout is done up front: labels, the data segment and the instruction index of
+ * every line. The instructions are encoded when execution first reaches them, see assemble_lazy().
  */
 #include "assembler.h"
+#include "memory.h"
 #include "register.h"
 #include "instruction.h"
 
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 
-char *instruction_data[MAX_NUM_INSTRUCTIONS];
+char **instruction_data = NULL;
+int line_count = 0;
+
 uint32_t bytecode[MAX_NUM_INSTRUCTIONS];
+int instruction_line[MAX_NUM_INSTRUCTIONS]; // Source line of each instruction
 int instruction_count = 0;
 
 char *label_name[MAX_NUM_INSTRUCTIONS];
-int label_index[MAX_NUM_INSTRUCTIONS];
+int label_index[MAX_NUM_INSTRUCTIONS];     // Instruction index, or -1 for data labels
+uint32_t label_address[MAX_NUM_INSTRUCTIONS];
 int label_count;
 
-#define INIT_PC 0x00400000
+// Open addressing index of the label table: position plus one, 0 for an empty slot.
+#define LABEL_HASH_SIZE (2 * MAX_NUM_INSTRUCTIONS)
+static int label_hash[LABEL_HASH_SIZE];
+
+uint8_t *data_segment = NULL;
+uint32_t data_size = 0;
+
+// Set while assembling lines after a .data directive.
+static int in_data_section = 0;
+
+// Registers of the move emitted last, used to drop a move that undoes it.
+static int last_move_rd = -1;
+static int last_move_rs = -1;
+
+// Lazy mode, see set_lazy_assembly().
+static int lazy_assembly = 0;
+static uint8_t instruction_encoded[MAX_NUM_INSTRUCTIONS];
+static int encoded_count = 0;
+
+// For every line in lazy mode: the index of its first instruction, or -1 if it has none, and the
+// move emitted before it.
+static int *line_index = NULL;
+static int *line_move_rd = NULL;
+static int *line_move_rs = NULL;
 
 /**
  * Loads the instructions from an assembly file.
@@ -34,17 +67,54 @@ void load_instruction_data(const char *filename)
         exit(1);
     }
 
-    char line[MAX_LINE_LENGTH];
+    size_t size = MAX_LINE_LENGTH;
+    char *line = (char *)malloc(size);
     int line_number = 0;
-    while (fgets(line, MAX_LINE_LENGTH, file) != NULL)
+    int capacity = 0;
+    while (line != NULL && fgets(line, (int)size, file) != NULL)
     {
+        // Long .word or .ascii lines do not fit in the buffer, so they are read in pieces.
+        size_t length = strlen(line);
+        while (length > 0 && line[length - 1] != '\n' && !feof(file))
+        {
+            char *longer = (char *)realloc(line, size * 2);
+            if (longer == NULL)
+            {
+                printf("Error: Could not allocate memory for %s\n", filename);
+                exit(1);
+            }
+            line = longer;
+            size *= 2;
+            if (fgets(line + length, (int)(size - length), file) == NULL)
+                break;
+            length += strlen(line + length);
+        }
+
+        // Data tables can make the file long, so the line array grows as needed.
+        if (line_number == capacity)
+        {
+            capacity = capacity == 0 ? MAX_NUM_INSTRUCTIONS : capacity * 2;
+            instruction_data = (char **)realloc(instruction_data, capacity * sizeof(char *));
+            if (instruction_data == NULL)
+            {
+                printf("Error: Could not allocate memory for %s\n", filename);
+                exit(1);
+            }
+        }
+
         // Remove newline character.
         line[strcspn(line, "\n")] = 0;
         instruction_data[line_number] = (char *)malloc(strlen(line) + 1);
         strcpy(instruction_data[line_number], line);
         line_number++;
     }
-    instruction_count = line_number;
+    if (line == NULL)
+    {
+        printf("Error: Could not allocate memory for %s\n", filename);
+        exit(1);
+    }
+    free(line);
+    line_count = line_number;
     fclose(file);
 }
 
@@ -55,14 +125,14 @@ void print_instruction_data()
 {
     printf("Instruction data:\n");
 
-    for (int i = 0; i < MAX_NUM_INSTRUCTIONS; i++)
+    for (int i = 0; i < line_count; i++)
         if (instruction_data[i] != NULL)
             printf("%s\n", instruction_data[i]);
 }
 
 /**
  * Initializes the assembler module.
- * @param instructions_data Filename of the file containing the instructions list
+ * @param instructions_data Filename of the file containing the instructions list, or NULL
  * @param asm_file Filename of the file containing the assembly code
  */
 void init_assembler(const char *instructions_data, const char *asm_file)
@@ -70,45 +140,685 @@ void init_assembler(const char *instructions_data, const char *asm_file)
     for (int i = 0; i < MAX_NUM_INSTRUCTIONS; i++)
         bytecode[i] = 0;
 
+    free(data_segment);
+    data_segment = NULL;
+    data_size = 0;
+
     load_instruction_data(asm_file);
 
-    // Load the instructions table.
-    load_instruction_table(instructions_data);
+    // The instruction table is compiled in, the instructions file is only checked when given.
+    if (instructions_data != NULL)
+        load_instruction_table(instructions_data);
 
     // Initialize the register table.
     init_register_table();
 
     // Initialize the label table.
     label_count = 0;
+    memset(label_hash, 0, sizeof(label_hash));
+}
+/**
+ * Get the value of an immediate operand: a decimal, hexadecimal (0x) or octal (0) number.
+ * @param token The operand
+ * @param line The line number in the source file, for errors
+ * @return The value
+ */
+static long long get_immediate(const char *token, int line)
+{
+    char *end = NULL;
+    long long value = token != NULL ? strtoll(token, &end, 0) : 0;
+    if (token == NULL || end == token || (*end != '\0' && *end != '\r'))
+    {
+        printf("Error: Invalid immediate %s on line %d.\n", token != NULL ? token : "(missing)", line);
+        exit(1);
+    }
+    return value;
+}
+
+/**
+ * Adds an instruction to the output of a line.
+ * @param words Output buffer, or NULL to only count the instructions
+ * @param count Number of instructions already emitted for the line
+ * @param index Index of the first instruction of the line
+ * @param format printf style format of the instruction text
+ * @return The new number of instructions emitted for the line
+ */
+static int emit(uint32_t *words, int count, int index, const char *format, ...)
+{
+    char instruction[MAX_LINE_LENGTH];
+    va_list args;
+
+    if (index + count >= MAX_NUM_INSTRUCTIONS)
+    {
+        printf("Error: Program exceeds %d instructions.\n", MAX_NUM_INSTRUCTIONS);
+        exit(1);
+    }
+
+    va_start(args, format);
+    vsnprintf(instruction, sizeof(instruction), format, args);
+    va_end(args);
+
+    if (words != NULL)
+        words[count] = assemble_instruction(instruction, index + count);
+    return count + 1;
+}
+
+/**
+ * Checks if an instruction is a load or a store.
+ */
+static int is_memory_access(int id)
+{
+    switch (id)
+    {
+    case INSTR_LB:
+    case INSTR_LBU:
+    case INSTR_LH:
+    case INSTR_LHU:
+    case INSTR_LW:
+    case INSTR_SB:
+    case INSTR_SH:
+    case INSTR_SW:
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Assembles a source line, expanding pseudo instructions into the shortest sequence of instructions.
+ * Moves that copy a register to itself or undo the previous move are dropped.
+ * Called once to lay out the program, when labels may be unknown, and once to emit it.
+ * @param line The line number in instruction_data
+ * @param index Index of the first instruction of the line
+ * @param words Output buffer, or NULL to only count the instructions
+ * @return The number of instructions of the line
+ */
+static int expand_line(int line, int index, uint32_t *words)
+{
+    char delim[] = " ,";
+    char *operands[3] = {NULL, NULL, NULL};
+    int count = 0;
+
+    char *line_copy = strdup(instruction_data[line]);
+    char *token = strtok(line_copy, delim);
+
+    // Blank lines and comments are not assembled.
+    if (token == NULL || token[0] == '#')
+    {
+        free(line_copy);
+        return 0;
+    }
+
+    // Control may enter at a label, so the previous move no longer holds.
+    if (token[strlen(token) - 1] == ':')
+    {
+        last_move_rd = -1;
+        token = strtok(NULL, delim);
+        if (token == NULL || token[0] == '#')
+        {
+            free(line_copy);
+            return 0;
+        }
+    }
+
+    char *mnemonic = token;
+    for (int i = 0; i < 3 && (token = strtok(NULL, delim)) != NULL && token[0] != '#'; i++)
+        operands[i] = token;
+
+    int move_rd = -1, move_rs = -1;
+
+    if (strcmp(mnemonic, "li") == 0)
+    {
+        int32_t value = (int32_t)get_immediate(operands[1], line + 1);
+        uint32_t upper = (uint32_t)value >> 16;
+        uint32_t lower = (uint32_t)value & 0xFFFF;
+
+        if (value >= -32768 && value <= 32767)
+            count = emit(words, count, index, "addi %s $zero %d", operands[0], value);
+        else if (upper == 0)
+            count = emit(words, count, index, "ori %s $zero %u", operands[0], lower);
+        else
+        {
+            count = emit(words, count, index, "lui %s %u", operands[0], upper);
+            if (lower != 0)
+                count = emit(words, count, index, "ori %s %s %u", operands[0], operands[0], lower);
+        }
+    }
+    else if (strcmp(mnemonic, "la") == 0)
+    {
+        // Label addresses are unknown while laying out, so la is always two instructions.
+        uint32_t address = 0;
+        if (words != NULL && get_label_address_by_name(operands[1], &address) == -1)
+        {
+            printf("Error: Label %s not found.\n", operands[1]);
+            exit(1);
+        }
+        count = emit(words, count, index, "lui %s %u", operands[0], address >> 16);
+        count = emit(words, count, index, "ori %s %s %u", operands[0], operands[0], address & 0xFFFF);
+    }
+    else if (is_memory_access(get_instruction_index(mnemonic)) && operands[1] != NULL && strchr(operands[1], '(') == NULL)
+    {
+        // Access to a label goes through $at, the offset is sign extended so the upper half is rounded.
+        uint32_t address = 0;
+        if (words != NULL && get_label_address_by_name(operands[1], &address) == -1)
+        {
+            printf("Error: Label %s not found.\n", operands[1]);
+            exit(1);
+        }
+        count = emit(words, count, index, "lui $at %u", ((address + 0x8000) >> 16) & 0xFFFF);
+        count = emit(words, count, index, "%s %s %d($at)", mnemonic, operands[0], (int16_t)(address & 0xFFFF));
+    }
+    else if (strcmp(mnemonic, "move") == 0)
+    {
+        move_rd = get_register_index_by_name(operands[0]);
+        move_rs = get_register_index_by_name(operands[1]);
+        if (move_rd != move_rs && !(move_rd == last_move_rs && move_rs == last_move_rd))
+            count = emit(words, count, index, "add %s %s $zero", operands[0], operands[1]);
+        else
+        {
+            move_rd = last_move_rd;
+            move_rs = last_move_rs;
+        }
+    }
+    else if (strcmp(mnemonic, "mul") == 0)
+    {
+        count = emit(words, count, index, "mult %s %s", operands[1], operands[2]);
+        count = emit(words, count, index, "mflo %s", operands[0]);
+    }
+    else if (strcmp(mnemonic, "blt") == 0 || strcmp(mnemonic, "bge") == 0)
+    {
+        count = emit(words, count, index, "slt $at %s %s", operands[0], operands[1]);
+        count = emit(words, count, index, "%s $at $zero %s", mnemonic[1] == 'l' ? "bne" : "beq", operands[2]);
+    }
+    else if (strcmp(mnemonic, "bgt") == 0 || strcmp(mnemonic, "ble") == 0)
+    {
+        count = emit(words, count, index, "slt $at %s %s", operands[1], operands[0]);
+        count = emit(words, count, index, "%s $at $zero %s", mnemonic[1] == 'g' ? "bne" : "beq", operands[2]);
+    }
+    else if (strcmp(mnemonic, "b") == 0)
+        count = emit(words, count, index, "beq $zero $zero %s", operands[0]);
+    else if (strcmp(mnemonic, "beqz") == 0 || strcmp(mnemonic, "bnez") == 0)
+        count = emit(words, count, index, "%s %s $zero %s", mnemonic[1] == 'e' ? "beq" : "bne", operands[0], operands[1]);
+    else
+        count = emit(words, count, index, "%s", instruction_data[line]);
+
+    last_move_rd = move_rd;
+    last_move_rs = move_rs;
+    free(line_copy);
+    return count;
+}
+
+static uint32_t hash_label(const char *label)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (; *label != '\0'; label++)
+        hash = (hash ^ (uint8_t)*label) * 16777619u;
+    return hash;
+}
+
+/**
+ * Get the position of a label in the label table.
+ * @return The position, or -1 if the label does not exist
+ */
+static int find_label(const char *label)
+{
+    for (uint32_t slot = hash_label(label) & (LABEL_HASH_SIZE - 1); label_hash[slot] != 0;
+         slot = (slot + 1) & (LABEL_HASH_SIZE - 1))
+        if (strcmp(label, label_name[label_hash[slot] - 1]) == 0)
+            return label_hash[slot] - 1;
+    return -1;
+}
+
+/**
+ * Adds a label to the label table.
+ * @param label The name of the label
+ * @param index The index of the labelled instruction, or -1 for a data label
+ * @param address The address of the label
+ */
+static void add_label(char *label, int index, uint32_t address)
+{
+    if (label_count == MAX_NUM_INSTRUCTIONS)
+    {
+        printf("Error: Program exceeds %d labels.\n", MAX_NUM_INSTRUCTIONS);
+        exit(1);
+    }
+
+    label_name[label_count] = (char *)malloc(strlen(label) + 1);
+    strcpy(label_name[label_count], label);
+    label_index[label_count] = index;
+    label_address[label_count] = address;
+
+    // The first definition of a label wins.
+    uint32_t slot = hash_label(label) & (LABEL_HASH_SIZE - 1);
+    for (; label_hash[slot] != 0; slot = (slot + 1) & (LABEL_HASH_SIZE - 1))
+        if (strcmp(label, label_name[label_hash[slot] - 1]) == 0)
+        {
+            label_count++;
+            return;
+        }
+    label_hash[slot] = label_count + 1;
+    label_count++;
+}
+
+/**
+ * Get the text of a line after its label.
+ * @return The first character after the label and the following blanks
+ */
+static char *skip_label(char *line)
+{
+    char *text = line + strspn(line, " \t");
+    char *end = text + strcspn(text, " \t");
+    if (end > text && end[-1] == ':')
+        text = end + strspn(end, " \t");
+    return text;
+}
+
+/**
+ * Reserves bytes in the data segment.
+ * @param line The line number, for errors
+ * @param offset The offset of the bytes
+ * @param length The number of bytes
+ * @return The offset after the bytes
+ */
+static uint32_t reserve_data(int line, uint32_t offset, uint32_t length)
+{
+    if (length > MAX_DATA_SEGMENT_SIZE - offset)
+    {
+        printf("Error: Data segment exceeds %u bytes on line %d.\n", MAX_DATA_SEGMENT_SIZE, line + 1);
+        exit(1);
+    }
+    return offset + length;
+}
+
+/**
+ * Lays out the string of an .ascii or .asciiz directive. The escapes \n, \t, \0, \\ and \" are supported.
+ * @param line The line number in instruction_data
+ * @param text The text following the directive
+ * @param offset The offset of the string in the data segment
+ * @param data The data segment, or NULL to only lay out the string
+ * @param terminate Add a terminating zero if non zero
+ * @return The offset after the string
+ */
+static uint32_t layout_string(int line, const char *text, uint32_t offset, uint8_t *data, int terminate)
+{
+    const char *c = strchr(text, '"');
+    if (c == NULL)
+    {
+        printf("Error: Missing string on line %d.\n", line + 1);
+        exit(1);
+    }
+
+    for (c++; *c != '"'; c++)
+    {
+        char value = *c;
+        if (value == '\\')
+        {
+            c++;
+            value = *c == 'n' ? '\n' : *c == 't' ? '\t' : *c == '0' ? '\0' : *c;
+        }
+        if (*c == '\0')
+        {
+            printf("Error: Unterminated string on line %d.\n", line + 1);
+            exit(1);
+        }
+
+        offset = reserve_data(line, offset, 1);
+        if (data != NULL)
+            data[offset - 1] = value;
+    }
+
+    if (terminate)
+        offset = reserve_data(line, offset, 1);
+    return offset;
+}
+
+/**
+ * Get the value of a .word, .half or .byte operand: a number, a character or a label.
+ */
+static uint32_t get_data_value(int line, char *token)
+{
+    char *end;
+    long long value = strtoll(token, &end, 0);
+    if (end != token && *end == '\0')
+        return (uint32_t)value;
+
+    if (token[0] == '\'' && token[1] != '\0' && token[2] == '\'')
+        return (uint8_t)token[1];
+
+    uint32_t address;
+    if (get_label_address_by_name(token, &address) == -1)
+    {
+        printf("Error: Invalid data value %s on line %d.\n", token, line + 1);
+        exit(1);
+    }
+    return address;
+}
+
+/**
+ * Lays out a directive. .text and .data switch sections, .globl is accepted and ignored, and the
+ * data directives reserve space in the data segment, aligned to the size of their values.
+ * Called once to lay out the data, and once to fill it in.
+ * @param line The line number in instruction_data
+ * @param directive The text of the line starting at the directive
+ * @param offset The offset of the next free byte in the data segment
+ * @param data The data segment, or NULL to only lay out the directive
+ * @param start Set to the offset the data of the directive starts at
+ * @return The offset after the directive
+ */
+static uint32_t layout_directive(int line, char *directive, uint32_t offset, uint8_t *data, uint32_t *start)
+{
+    char delim[] = " ,\t";
+    int length = strcspn(directive, " \t#");
+    char *operands = directive + length;
+    uint32_t size = 0;
+
+    *start = offset;
+    if (strncmp(directive, ".text", length) == 0 && length == 5)
+    {
+        in_data_section = 0;
+        return offset;
+    }
+    if (strncmp(directive, ".data", length) == 0 && length == 5)
+    {
+        in_data_section = 1;
+        return offset;
+    }
+    if ((strncmp(directive, ".globl", length) == 0 && length == 6) ||
+        (strncmp(directive, ".global", length) == 0 && length == 7))
+        return offset;
+
+    if (!in_data_section)
+    {
+        printf("Error: Directive %.*s outside of .data on line %d.\n", length, directive, line + 1);
+        exit(1);
+    }
+
+    if (strncmp(directive, ".ascii", length) == 0 && length == 6)
+        return layout_string(line, operands, offset, data, 0);
+    if (strncmp(directive, ".asciiz", length) == 0 && length == 7)
+        return layout_string(line, operands, offset, data, 1);
+
+    if (strncmp(directive, ".word", length) == 0 && length == 5)
+        size = 4;
+    else if (strncmp(directive, ".half", length) == 0 && length == 5)
+        size = 2;
+    else if (strncmp(directive, ".byte", length) == 0 && length == 5)
+        size = 1;
+    else if (strncmp(directive, ".space", length) == 0 && length == 6)
+        return reserve_data(line, offset, strtoul(operands, NULL, 0));
+    else if (strncmp(directive, ".align", length) == 0 && length == 6)
+    {
+        uint32_t alignment = 1u << (strtoul(operands, NULL, 0) & 0x1F);
+        offset = reserve_data(line, offset, (alignment - offset % alignment) % alignment);
+        *start = offset;
+        return offset;
+    }
+    else
+    {
+        printf("Error: Unknown directive %.*s on line %d.\n", length, directive, line + 1);
+        exit(1);
+    }
+
+    // Values are aligned to their size.
+    offset = reserve_data(line, offset, (size - offset % size) % size);
+    *start = offset;
+
+    char *operands_copy = strdup(operands);
+    operands_copy[strcspn(operands_copy, "#")] = '\0';
+    for (char *token = strtok(operands_copy, delim); token != NULL; token = strtok(NULL, delim))
+    {
+        offset = reserve_data(line, offset, size);
+        if (data == NULL)
+            continue;
+
+        // Values are stored big endian.
+        uint32_t value = get_data_value(line, token);
+        for (uint32_t i = 0; i < size; i++)
+            data[offset - 1 - i] = value >> (i * 8);
+    }
+    free(operands_copy);
+    return offset;
 }
+
 /**
- * Parses the instructions line by line and assembles them into bytecode. Also loads the label table.
+ * Allocates the line index of lazy mode, with no line holding instructions.
+ */
+static void init_line_index()
+{
+    free(line_index);
+    free(line_move_rd);
+    free(line_move_rs);
+    line_index = (int *)malloc((line_count + 1) * sizeof(int));
+    line_move_rd = (int *)malloc((line_count + 1) * sizeof(int));
+    line_move_rs = (int *)malloc((line_count + 1) * sizeof(int));
+    if (line_index == NULL || line_move_rd == NULL || line_move_rs == NULL)
+    {
+        printf("Error: Could not allocate the line index.\n");
+        exit(1);
+    }
+    for (int i = 0; i < line_count; i++)
+        line_index[i] = -1;
+}
+
+/**
+ * Parses the instructions line by line and assembles them into bytecode. Also loads the label table
+ * and builds the data segment.
+ * Labels point at instructions, since lines may assemble to no or several instructions, or at data.
+ * In lazy mode the instructions are only laid out, not encoded.
  */
 void assemble()
 {
-    // Get labels.
-    for (int i = 0; i < instruction_count; i++)
+    // Lay out the program and the data and get labels.
+    int index = 0;
+    uint32_t offset = 0;
+    in_data_section = 0;
+    last_move_rd = -1;
+    if (lazy_assembly)
+        init_line_index();
+    for (int i = 0; i < line_count; i++)
         if (instruction_data[i] != NULL)
         {
+            char *text = skip_label(instruction_data[i]);
+            uint32_t start = offset;
+            if (text[0] == '.')
+                offset = layout_directive(i, text, offset, NULL, &start);
+            else if (in_data_section && text[0] != '\0' && text[0] != '#')
+            {
+                printf("Error: Instruction in .data on line %d.\n", i + 1);
+                exit(1);
+            }
+
             char *label = get_label(instruction_data[i]);
-            if (label != NULL)
+            if (label != NULL && in_data_section)
+                add_label(label, -1, DATA_SEGMENT_START + start);
+            else if (label != NULL)
+                add_label(label, index, INIT_PC + index * 4);
+
+            if (text[0] != '.' && !in_data_section)
             {
-                label_name[label_count] = (char *)malloc(strlen(label) + 1);
-                strcpy(label_name[label_count], label);
-                label_index[label_count] = i;
-                label_count++;
+                if (lazy_assembly)
+                {
+                    line_move_rd[i] = last_move_rd;
+                    line_move_rs[i] = last_move_rs;
+                }
+                int count = expand_line(i, index, NULL);
+                if (lazy_assembly && count > 0)
+                    line_index[i] = index;
+                for (int j = 0; j < count; j++)
+                    instruction_line[index + j] = i;
+                index += count;
             }
-        };
+        }
 
-    // Assemble the instructions.
-    for (int i = 0; i < instruction_count; i++)
+    // The data segment is allocated in whole pages, at least one, so that it can be mapped as guest memory.
+    data_size = offset;
+    data_segment = (uint8_t *)calloc(data_size / MEMORY_PAGE_SIZE + 1, MEMORY_PAGE_SIZE);
+    if (data_segment == NULL)
+    {
+        printf("Error: Could not allocate a data segment of %u bytes.\n", data_size);
+        exit(1);
+    }
+
+    // Assemble the instructions and fill in the data.
+    last_move_rd = -1;
+    instruction_count = 0;
+    offset = 0;
+    in_data_section = 0;
+    for (int i = 0; i < line_count; i++)
         if (instruction_data[i] != NULL)
-            bytecode[i] = assemble_instruction(instruction_data[i], i);
+        {
+            char *text = skip_label(instruction_data[i]);
+            uint32_t start;
+            if (text[0] == '.')
+            {
+                offset = layout_directive(i, text, offset, data_segment, &start);
+                continue;
+            }
+            if (in_data_section || lazy_assembly)
+                continue;
+
+            int count = expand_line(i, instruction_count, &bytecode[instruction_count]);
+            for (int j = 0; j < count; j++)
+                instruction_line[instruction_count + j] = i;
+            instruction_count += count;
+        }
+
+    if (lazy_assembly)
+    {
+        instruction_count = index;
+        memset(instruction_encoded, 0, instruction_count);
+        encoded_count = 0;
+        printf("Laid out %d instructions for lazy assembly.\n", instruction_count);
+        return;
+    }
+    memset(instruction_encoded, 1, instruction_count);
+    encoded_count = instruction_count;
 
     // Print the bytecode.
     print_bytecode();
 }
 
+/**
+ * Selects lazy assembly for the next assemble(): lines are encoded when execution first reaches them.
+ * Saves the encoding of code that never runs, at the cost of a check per executed block.
+ * @param enabled 1 for lazy assembly, 0 to encode everything up front
+ */
+void set_lazy_assembly(int enabled)
+{
+    lazy_assembly = enabled;
+}
+
+/**
+ * Checks if lazy assembly is selected.
+ */
+int get_lazy_assembly()
+{
+    return lazy_assembly;
+}
+
+/**
+ * Checks if an instruction has been encoded into bytecode[].
+ * @param index The index of the instruction
+ * @return 1 if it was encoded, 0 if lazy assembly has not reached it yet
+ */
+int is_instruction_encoded(int index)
+{
+    return instruction_encoded[index];
+}
+
+/**
+ * Get the number of instructions encoded into bytecode[].
+ */
+int get_encoded_count()
+{
+    return encoded_count;
+}
+
+/**
+ * Checks if a bytecode may transfer control.
+ */
+static int is_control_transfer(uint32_t word)
+{
+    switch (decode_instruction(word))
+    {
+    case INSTR_BEQ:
+    case INSTR_BNE:
+    case INSTR_BLEZ:
+    case INSTR_BGTZ:
+    case INSTR_J:
+    case INSTR_JAL:
+    case INSTR_JR:
+    case INSTR_JALR:
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Encodes the lines from the one holding an instruction up to the first line that transfers control,
+ * an already encoded line or the end of the program. Lines are encoded with the move state of the
+ * layout, so they expand to the instructions that were laid out.
+ * @param index The index of an instruction that is not encoded yet
+ * @param first Set to the index of the first encoded instruction, the start of the line of index
+ * @return The index after the last encoded instruction
+ */
+int assemble_lazy(int index, int *first)
+{
+    int line = instruction_line[index];
+    int end = line_index[line];
+    *first = end;
+
+    for (; line < line_count && end < instruction_count; line++)
+    {
+        if (line_index[line] == -1)
+            continue;
+        if (instruction_encoded[line_index[line]])
+            break;
+
+        last_move_rd = line_move_rd[line];
+        last_move_rs = line_move_rs[line];
+        int count = expand_line(line, end, &bytecode[end]);
+        memset(&instruction_encoded[end], 1, count);
+        encoded_count += count;
+        end += count;
+
+        if (is_control_transfer(bytecode[end - 1]))
+            break;
+    }
+    return end;
+}
+
+/**
+ * Get the index of the instruction a branch or jump goes to.
+ * @param label The target operand
+ * @param index The index of the branch or jump, for errors
+ * @return The index of the labelled instruction
+ */
+static int get_target_index(char *label, int index)
+{
+    int line = instruction_line[index] + 1;
+    if (label == NULL)
+    {
+        printf("Error: Missing branch or jump target on line %d.\n", line);
+        exit(1);
+    }
+
+    uint32_t address;
+    if (get_label_address_by_name(label, &address) == -1)
+    {
+        printf("Error: Label %s not found on line %d.\n", label, line);
+        exit(1);
+    }
+
+    int target = get_label_index_by_name(label);
+    if (target == -1)
+    {
+        printf("Error: Branch or jump to data label %s on line %d.\n", label, line);
+        exit(1);
+    }
+    return target;
+}
+
 /**
  * Converts a single instruction into bytecode.
  * @param instruction The instruction to convert
@@ -118,8 +828,6 @@ uint32_t assemble_instruction(char *instruction, int line_number)
 {
     char *token;
     char delim[] = " ,";
-    uint32_t opcode = 0;
-    uint32_t funct = 0;
 
     // Make a copy of the instruction string using stringdup.
     char *instruction_copy = strdup(instruction);
@@ -127,14 +835,14 @@ uint32_t assemble_instruction(char *instruction, int line_number)
     // Split the instruction into tokens.
     token = strtok(instruction_copy, delim);
 
-    // Check if the instruction is a comment.
-    if (token[0] == '#')
-        return 0;
-
     // Check if the instruction is a blank line.
     if (token == NULL)
         return 0;
 
+    // Check if the instruction is a comment.
+    if (token[0] == '#')
+        return 0;
+
     // Check if the instruction has a label.
     if (token[strlen(token) - 1] == ':')
     {
@@ -149,147 +857,217 @@ uint32_t assemble_instruction(char *instruction, int line_number)
         return 0;
     }
 
-    // Check if instruction list contains the instruction.
-    if (get_instruction_index(token) == -1)
+    // Check if the compiled-in instruction list contains the instruction.
+    int id = get_instruction_index(token);
+    if (id == -1 || id >= NUM_INSTRUCTIONS)
     {
         printf("Error: Instruction %s not found.\n", token);
         exit(1);
     }
 
-    // Create a temporary bytecode variable.
-    int32_t tempBytecode = 0;
+    // Create a temporary bytecode variable holding the opcode and function code.
+    uint32_t tempBytecode = encode_instruction(id);
 
-    // Get the opcode and  adding it to the bytecode.
-    opcode = get_instruction_opcode_by_name(token);
-    tempBytecode = opcode << 26;
+    switch (id)
+    {
+    // Jump register instructions.
+    case INSTR_JR:
+    case INSTR_JALR:
+    {
+        // Get the source register and destination address.
+        uint32_t rd = (id == INSTR_JALR) ? 31 : 0;
+        uint32_t address = get_register_index_by_name(strtok(NULL, delim));
 
-    // R - type instructions.
-    if (opcode == 0x0)
+        tempBytecode |= (address << 21) | (rd << 11);
+        break;
+    }
+
+    // Shift instructions.
+    case INSTR_SLL:
+    case INSTR_SRL:
+    case INSTR_SRA:
     {
-        // Get function code and adding it to the bytecode.
-        funct = get_instruction_funct_by_name(token);
-        tempBytecode |= (funct << 0);
+        // Get the source register, destination register and shift amount.
+        token = strtok(NULL, delim);
+        uint32_t rd = get_register_index_by_name(token);
+        token = strtok(NULL, delim);
+        uint32_t rt = get_register_index_by_name(token);
+        token = strtok(NULL, delim);
+        uint32_t shamt = get_immediate(token, instruction_line[line_number] + 1) & 0x1F;
 
-        // Check if the instruction is jalr or jr.
-        if (funct == 0x8 || funct == 0x9)
-        {
-            // Get the source register and destination address.
-            uint32_t rs = 31;
-            uint32_t address = get_register_index_by_name(strtok(NULL, delim));
+        // Add the register values and shift amount to the bytecode.
+        tempBytecode |= (rt << 16) | (rd << 11) | (shamt << 6);
+        break;
+    }
 
-            // Check if the instruction is jr.
-            if (funct == 0x8)
-                rs = 0;
+    // Three register instructions.
+    case INSTR_ADD:
+    case INSTR_SUB:
+    case INSTR_AND:
+    case INSTR_OR:
+    case INSTR_XOR:
+    case INSTR_NOR:
+    case INSTR_SLT:
+    {
+        // Get the register values.
+        token = strtok(NULL, delim);
+        uint32_t rd = get_register_index_by_name(token);
+        token = strtok(NULL, delim);
+        uint32_t rs = get_register_index_by_name(token);
+        token = strtok(NULL, delim);
+        uint32_t rt = get_register_index_by_name(token);
 
-            tempBytecode |= (address << 21) | (rs << 11);
-        }
+        // Add the register values to the bytecode.
+        tempBytecode |= (rs << 21) | (rt << 16) | (rd << 11);
+        break;
+    }
 
-        // Check if the instruction is sll or srl.
-        else if (funct == 0x0 || funct == 0x2)
-        {
-            // Get the source register, destination register and shift amount.
-            token = strtok(NULL, delim);
-            uint32_t rd = get_register_index_by_name(token);
-            token = strtok(NULL, delim);
-            uint32_t rt = get_register_index_by_name(token);
-            token = strtok(NULL, delim);
-            uint32_t shamt = atoi(token);
-            // check if shamt is negative.
-            if (shamt < 0)
-                shamt = 0x20 + shamt;
-
-            // Add the register values and shift amount to the bytecode.
-            tempBytecode |= (rt << 16) | (rd << 11) | (shamt << 6);
-        }
+    // Multiply and divide write hi and lo.
+    case INSTR_MULT:
+    case INSTR_DIV:
+    {
+        token = strtok(NULL, delim);
+        uint32_t rs = get_register_index_by_name(token);
+        token = strtok(NULL, delim);
+        uint32_t rt = get_register_index_by_name(token);
 
-        // Check if the instruction is one of add, sub, div, nor, xor, or.
-        else if (funct == 0x20 || funct == 0x24 || funct == 0x25 || funct == 0x26 || funct == 0x27)
-        {
-            // Get the register values.
-            token = strtok(NULL, delim);
-            uint32_t rd = get_register_index_by_name(token);
-            token = strtok(NULL, delim);
-            uint32_t rs = get_register_index_by_name(token);
-            token = strtok(NULL, delim);
-            uint32_t rt = get_register_index_by_name(token);
-
-            // Add the register values to the bytecode.
-            tempBytecode |= (rs << 21) | (rt << 16) | (rd << 11);
-        }
+        tempBytecode |= (rs << 21) | (rt << 16);
+        break;
+    }
+
+    // Moves from hi and lo.
+    case INSTR_MFHI:
+    case INSTR_MFLO:
+    {
+        token = strtok(NULL, delim);
+        uint32_t rd = get_register_index_by_name(token);
+
+        tempBytecode |= (rd << 11);
+        break;
+    }
+
+    // Load upper immediate.
+    case INSTR_LUI:
+    {
+        token = strtok(NULL, delim);
+        uint32_t rt = get_register_index_by_name(token);
+        token = strtok(NULL, delim);
+        uint16_t imm = get_immediate(token, instruction_line[line_number] + 1);
+
+        tempBytecode |= (rt << 16) | (imm << 0);
+        break;
     }
 
-    // I-type instruction
-    else if ((opcode >= 0x4 && opcode <= 0x8) || opcode == 0xA || opcode == 0xC || opcode == 0xE)
+    // Loads and stores address memory as offset(base).
+    case INSTR_LB:
+    case INSTR_LBU:
+    case INSTR_LH:
+    case INSTR_LHU:
+    case INSTR_LW:
+    case INSTR_SB:
+    case INSTR_SH:
+    case INSTR_SW:
     {
-        uint32_t rs, rt;
-        uint16_t imm;
         token = strtok(NULL, delim);
-        rs = get_register_index_by_name(token);
+        uint32_t rt = get_register_index_by_name(token);
         token = strtok(NULL, delim);
 
-        // Check if the instruction is beq or bne.
-        if (opcode == 0x4 || opcode == 0x5)
+        // The offset may be left out, as in ($sp).
+        char *base = strchr(token, '(');
+        char *end = base != NULL ? strchr(base, ')') : NULL;
+        if (end == NULL)
         {
-            // Get the register value and adding it to the bytecode.
-            rt = get_register_index_by_name(token);
-            tempBytecode |= (rs << 21) | (rt << 16);
-
-            // Calculate the offset of branching.
-            token = strtok(NULL, delim);
-            uint32_t jump_to = get_label_index_by_name(token);
-            uint32_t jump_from = line_number;
-            uint16_t offset = jump_to - jump_from - 1;
-
-            // Check if offset is negative, if so then take 2's complement.
-            if (offset < 0)
-                offset = ~offset + 1;
-
-            // Add the offset to the bytecode.
-            tempBytecode |= offset;
+            printf("Error: Invalid address %s.\n", token);
+            exit(1);
         }
+        *end = '\0';
+        *base = '\0';
+        uint16_t offset = token == base ? 0 : get_immediate(token, instruction_line[line_number] + 1);
+        uint32_t rs = get_register_index_by_name(base + 1);
 
-        // Check if the instruction is blez or bgtz.
-        else if (opcode == 0x6 || opcode == 0x7)
-        {
-            // Calculating the offset and adding it to the bytecode.
-            uint32_t jump_to = get_label_index_by_name(token);
-            uint32_t jump_from = line_number;
-            uint16_t offset = jump_to - jump_from - 1;
+        tempBytecode |= (rs << 21) | (rt << 16) | (offset << 0);
+        break;
+    }
 
-            // Check if offset is negative, if so then take 2's complement.
-            if (offset < 0)
-                offset = ~offset + 1;
+    // Branches comparing two registers.
+    case INSTR_BEQ:
+    case INSTR_BNE:
+    {
+        // Get the register values and add them to the bytecode.
+        token = strtok(NULL, delim);
+        uint32_t rs = get_register_index_by_name(token);
+        token = strtok(NULL, delim);
+        uint32_t rt = get_register_index_by_name(token);
+        tempBytecode |= (rs << 21) | (rt << 16);
 
-            tempBytecode |= (rs << 21) | (offset << 0);
-        }
+        // Calculate the offset of branching, negative offsets are stored as two's complement.
+        token = strtok(NULL, delim);
+        uint32_t jump_to = get_target_index(token, line_number);
+        uint32_t jump_from = line_number;
+        uint16_t offset = jump_to - jump_from - 1;
 
-        // Remaining I-type instructions. (addi, andi, subi, ori)
-        else
-        {
-            rt = get_register_index_by_name(token);
-            token = strtok(NULL, delim);
-            imm = atoi(token);
+        // Add the offset to the bytecode.
+        tempBytecode |= offset;
+        break;
+    }
 
-            // Check if imm is negative. If so, get the two's complement.
-            if (imm < 0)
-                imm = ~imm + 1;
+    // Branches comparing a register with zero.
+    case INSTR_BLEZ:
+    case INSTR_BGTZ:
+    {
+        token = strtok(NULL, delim);
+        uint32_t rs = get_register_index_by_name(token);
 
-            tempBytecode |= (rs << 16) | (rt << 21) | (imm << 0);
-        }
+        // Calculating the offset and adding it to the bytecode.
+        token = strtok(NULL, delim);
+        uint32_t jump_to = get_target_index(token, line_number);
+        uint32_t jump_from = line_number;
+        uint16_t offset = jump_to - jump_from - 1;
+
+        tempBytecode |= (rs << 21) | (offset << 0);
+        break;
+    }
+
+    // Immediate instructions.
+    case INSTR_ADDI:
+    case INSTR_ANDI:
+    case INSTR_SUBI:
+    case INSTR_ORI:
+    {
+        token = strtok(NULL, delim);
+        uint32_t rt = get_register_index_by_name(token);
+        token = strtok(NULL, delim);
+        uint32_t rs = get_register_index_by_name(token);
+        token = strtok(NULL, delim);
+
+        // Negative immediates are stored as 16 bit two's complement.
+        uint16_t imm = get_immediate(token, instruction_line[line_number] + 1);
+
+        tempBytecode |= (rs << 21) | (rt << 16) | (imm << 0);
+        break;
     }
 
-    // J-type instruction
-    else if (opcode == 0x2 || opcode == 0x3)
+    // Jump instructions.
+    case INSTR_J:
+    case INSTR_JAL:
     {
         token = strtok(NULL, delim);
-        uint32_t address = get_label_index_by_name(token);
+        uint32_t address = get_target_index(token, line_number);
 
         // calculate the address to jump to.
         address = INIT_PC + address * 4;
 
         // Add the address to the bytecode.
-        tempBytecode |= ((address >> 2) & 0x3FFFFF);
+        tempBytecode |= ((address >> 2) & 0x3FFFFFF);
+        break;
     }
+
+    default:
+        printf("Error: Instruction %s cannot be assembled.\n", token);
+        exit(1);
+    }
+
+    free(instruction_copy);
     return tempBytecode;
 }
 
@@ -314,18 +1092,57 @@ char *get_label(char *instruction)
 }
 
 /**
- * Returns the index of the label in the label table.
+ * Returns the index of the instruction a label points at, or -1 for unknown and data labels.
  */
 int get_label_index_by_name(char *label)
 {
+    int position = find_label(label);
+    return position == -1 ? -1 : label_index[position];
+}
+
+/**
+ * Get the address of a label in the text or data segment.
+ * @param label The name of the label
+ * @param address Set to the address of the label
+ * @return 0 on success, -1 if the label does not exist
+ */
+int get_label_address_by_name(char *label, uint32_t *address)
+{
+    int position = find_label(label);
+    if (position == -1)
+        return -1;
+    *address = label_address[position];
+    return 0;
+}
+
+/**
+ * Get the label an instruction belongs to, the closest label at or before it.
+ * @param index The index of the instruction
+ * @param offset Set to the number of bytes from the label to the instruction
+ * @return The name of the label, or NULL if no label precedes the instruction
+ */
+char *get_label_before(int index, int *offset)
+{
+    int best = -1;
     for (int i = 0; i < label_count; i++)
-    {
-        if (strcmp(label, label_name[i]) == 0)
-        {
-            return label_index[i];
-        }
-    }
-    return -1;
+        if (label_index[i] != -1 && label_index[i] <= index && (best == -1 || label_index[i] >= label_index[best]))
+            best = i;
+
+    if (best == -1)
+        return NULL;
+    *offset = (index - label_index[best]) * 4;
+    return label_name[best];
+}
+
+/**
+ * Marks the instructions labels point at.
+ * @param marks One entry per instruction, set to 1 for labelled instructions and left alone otherwise
+ */
+void mark_label_targets(uint8_t *marks)
+{
+    for (int i = 0; i < label_count; i++)
+        if (label_index[i] >= 0 && label_index[i] < instruction_count)
+            marks[label_index[i]] = 1;
 }
 
 /**
@@ -336,6 +1153,11 @@ void print_bytecode()
 {
     for (int i = 0; i < instruction_count; i++)
     {
-        printf("0x%08x   0x%08x  %s\n", INIT_PC + i * 4, bytecode[i], instruction_data[i]);
+        // Show the source line next to its first instruction.
+        int first = i == 0 || instruction_line[i] != instruction_line[i - 1];
+        printf("0x%08x   0x%08x  %s\n", INIT_PC + i * 4, bytecode[i], first ? instruction_data[instruction_line[i]] : "");
     }
+
+    if (data_size > 0)
+        printf("Data segment: %u bytes at 0x%08x\n", data_size, DATA_SEGMENT_START);
 }
\ No newline at end of file
@@ -3,11 +3,17 @@
 
 #include <stdint.h>
 
-#define MAX_NUM_INSTRUCTIONS 256 // Maximum number of instructions
-#define MAX_LINE_LENGTH 256      // Maximum length of an instruction
+#define MAX_NUM_INSTRUCTIONS 65536 // Maximum number of instructions
+#define MAX_LINE_LENGTH 256        // Maximum length of an instruction
+#define INIT_PC 0x00400000         // Address of the first instruction
 
 extern uint32_t bytecode[MAX_NUM_INSTRUCTIONS];
-extern char *instruction_data[MAX_NUM_INSTRUCTIONS];
+extern char **instruction_data;
+extern int line_count;
+extern int instruction_line[MAX_NUM_INSTRUCTIONS];
+extern int instruction_count;
+extern uint8_t *data_segment;
+extern uint32_t data_size;
 
 void load_instruction_data(const char *filename);
 void print_instruction_data();
@@ -15,8 +21,16 @@ void init_assembler(const char *instructions_data, const char *asm_file);
 uint32_t assemble_instruction(char *instruction, int line_number);
 void print_bytecode();
 void assemble();
+void set_lazy_assembly(int enabled);
+int get_lazy_assembly();
+int is_instruction_encoded(int index);
+int get_encoded_count();
+int assemble_lazy(int index, int *first);
 
 char *get_label(char *instruction);
 int get_label_index_by_name(char *label_name);
+int get_label_address_by_name(char *label, uint32_t *address);
+char *get_label_before(int index, int *offset);
+void mark_label_targets(uint8_t *marks);
 
 #endif // ASSEMBLER_H
\ No newline at end of file
@@ -0,0 +1,273 @@
+/**
+ * Implementation of the debugger module.
+ * Breakpoints replace the internal instruction at their address with OP_BREAK and keep the original
+ * operation to restore it on removal. Watchpoints swap in a register write handler that compares the
+ * old and new values, and make the executor check for stops after every instruction while any
+ * watchpoint is set. Without breakpoints or watchpoints the executor runs unchanged.
+ */
+#include "debugger.h"
+#include "assembler.h"
+#include "register.h"
+
+#include <stdio.h>
+
+typedef struct breakpoint
+{
+    uint32_t pc; // Address the breakpoint was set at
+    int index;   // Internal instruction patched with OP_BREAK
+    uint16_t op; // Original operation of the instruction
+} Breakpoint;
+
+static Breakpoint breakpoints[MAX_BREAKPOINTS];
+static int breakpoint_count = 0;
+
+// Breakpoint the last run stopped at, stepped over by the next run.
+static int resume_index = -1;
+
+// Bit mask of the watched registers.
+static uint32_t watch_mask = 0;
+
+// Last watchpoint hit.
+static int watch_hit = 0;
+static int watch_index, watch_old_value, watch_new_value;
+
+/**
+ * Find the breakpoint patched over an internal instruction.
+ * @return The index in breakpoints[], or -1 if there is none
+ */
+static int find_breakpoint(int index)
+{
+    for (int i = 0; i < breakpoint_count; i++)
+        if (breakpoints[i].index == index)
+            return i;
+    return -1;
+}
+
+/**
+ * Set a breakpoint at an address. If the optimizer removed the instruction at the address, the
+ * breakpoint is placed on the next instruction that is executed.
+ * @param pc The address of the instruction
+ * @return 0 on success, -1 if the breakpoint cannot be set
+ */
+int set_breakpoint(uint32_t pc)
+{
+    int index = get_exec_index(pc);
+    if (index == -1 || index >= exec_count)
+    {
+        printf("Invalid breakpoint address: 0x%08x\n", pc);
+        return -1;
+    }
+
+    if (find_breakpoint(index) != -1)
+        return 0;
+
+    if (breakpoint_count == MAX_BREAKPOINTS)
+    {
+        printf("Error: Too many breakpoints.\n");
+        return -1;
+    }
+
+    breakpoints[breakpoint_count].pc = pc;
+    breakpoints[breakpoint_count].index = index;
+    breakpoints[breakpoint_count].op = exec_code[index].op;
+    breakpoint_count++;
+    exec_code[index].op = OP_BREAK;
+    return 0;
+}
+
+/**
+ * Set a breakpoint at a label.
+ * @param label The name of the label
+ * @return 0 on success, -1 if the breakpoint cannot be set
+ */
+int set_breakpoint_at_label(char *label)
+{
+    int index = get_label_index_by_name(label);
+    if (index == -1)
+    {
+        printf("Invalid label: %s\n", label);
+        return -1;
+    }
+    return set_breakpoint(INIT_PC + index * 4);
+}
+
+/**
+ * Remove the breakpoint at an address and restore the original instruction.
+ * @param pc The address of the instruction
+ * @return 0 on success, -1 if there is no breakpoint at the address
+ */
+int remove_breakpoint(uint32_t pc)
+{
+    int index = get_exec_index(pc);
+    int breakpoint = index == -1 ? -1 : find_breakpoint(index);
+    if (breakpoint == -1)
+        return -1;
+
+    exec_code[index].op = breakpoints[breakpoint].op;
+    breakpoints[breakpoint] = breakpoints[--breakpoint_count];
+    return 0;
+}
+
+/**
+ * Remove the breakpoint at a label.
+ * @param label The name of the label
+ * @return 0 on success, -1 if there is no breakpoint at the label
+ */
+int remove_breakpoint_at_label(char *label)
+{
+    int index = get_label_index_by_name(label);
+    if (index == -1)
+        return -1;
+    return remove_breakpoint(INIT_PC + index * 4);
+}
+
+/**
+ * Remove all breakpoints.
+ */
+void clear_breakpoints()
+{
+    for (int i = 0; i < breakpoint_count; i++)
+        exec_code[breakpoints[i].index].op = breakpoints[i].op;
+    breakpoint_count = 0;
+}
+
+/**
+ * Decodes bytecode[] again after it was modified, keeping the breakpoints. The program is not
+ * optimized again since the optimizer assumes the code does not change.
+ */
+void reload_program()
+{
+    uint32_t pcs[MAX_BREAKPOINTS];
+    int count = breakpoint_count;
+    for (int i = 0; i < count; i++)
+        pcs[i] = breakpoints[i].pc;
+
+    clear_breakpoints();
+    load_program();
+
+    for (int i = 0; i < count; i++)
+        set_breakpoint(pcs[i]);
+}
+
+/**
+ * Register write handler used while watchpoints are set.
+ */
+static void write_register_watched(int index, int value)
+{
+    if (index == 0)
+        return;
+
+    int old_value = get_register_value(index);
+    store_register(index, value);
+
+    if ((watch_mask & (1u << index)) && old_value != value)
+    {
+        watch_hit = 1;
+        watch_index = index;
+        watch_old_value = old_value;
+        watch_new_value = value;
+        request_stop_with_status(EXEC_WATCHPOINT);
+    }
+}
+
+/**
+ * Watch a register for changes.
+ * @param index The index of the register
+ * @return 0 on success, -1 if the register cannot be watched
+ */
+int add_watchpoint(int index)
+{
+    if (index <= 0 || index >= REGISTER_TABLE_SIZE)
+    {
+        printf("Invalid watchpoint register: %d\n", index);
+        return -1;
+    }
+
+    if (watch_mask == 0)
+    {
+        set_register_writer(write_register_watched);
+        set_block_stepping(1);
+    }
+    watch_mask |= 1u << index;
+    return 0;
+}
+
+/**
+ * Stop watching a register.
+ * @param index The index of the register
+ * @return 0 on success, -1 if the register was not watched
+ */
+int remove_watchpoint(int index)
+{
+    if (index <= 0 || index >= REGISTER_TABLE_SIZE || !(watch_mask & (1u << index)))
+        return -1;
+
+    watch_mask &= ~(1u << index);
+    if (watch_mask == 0)
+    {
+        set_register_writer(NULL);
+        set_block_stepping(0);
+    }
+    return 0;
+}
+
+/**
+ * Get the last watchpoint hit and clear it.
+ * @return 1 if a watchpoint was hit since the last call, 0 otherwise
+ */
+int get_watchpoint_hit(int *index, int *old_value, int *new_value)
+{
+    if (!watch_hit)
+        return 0;
+
+    *index = watch_index;
+    *old_value = watch_old_value;
+    *new_value = watch_new_value;
+    watch_hit = 0;
+    return 1;
+}
+
+/**
+ * Marks that the program stopped at the breakpoint at an address, so that the next run steps over it.
+ * @param pc The address of the breakpoint, or an address without breakpoint to clear the mark
+ */
+void set_resume_pc(uint32_t pc)
+{
+    int index = get_exec_index(pc);
+    resume_index = (index != -1 && find_breakpoint(index) != -1) ? index : -1;
+}
+
+/**
+ * Runs the program from the current pc. If the last run stopped at the breakpoint at the pc, the
+ * breakpoint is stepped over by executing the original instruction once, so that execution can
+ * continue after a breakpoint was reached.
+ * @param budget Maximum number of instructions to execute, EXEC_UNLIMITED for no limit
+ * @return The result of the run
+ */
+ExecResult debug_run(uint64_t budget)
+{
+    ExecResult result;
+    int index = get_exec_index(get_pc());
+    int breakpoint = (index == -1 || index != resume_index) ? -1 : find_breakpoint(index);
+
+    if (breakpoint == -1 || budget == 0)
+        result = execute(budget);
+    else
+    {
+        exec_code[index].op = breakpoints[breakpoint].op;
+        result = execute(1);
+        // Lazy assembly may have decoded the placeholder under the breakpoint.
+        breakpoints[breakpoint].op = exec_code[index].op;
+        exec_code[index].op = OP_BREAK;
+
+        if (result.status == EXEC_BUDGET_EXHAUSTED && budget > 1)
+        {
+            uint64_t retired = result.retired;
+            result = execute(budget == EXEC_UNLIMITED ? budget : budget - 1);
+            result.retired += retired;
+        }
+    }
+
+    resume_index = result.status == EXEC_BREAKPOINT ? get_exec_index(result.pc) : -1;
+    return result;
+}
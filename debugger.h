@@ -0,0 +1,29 @@
+/**
+ * Header file for the debugger module.
+ * Breakpoints are patched into the internal code stream and watchpoints swap in a register write
+ * handler, so neither costs anything while none are set.
+ */
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+#include <stdint.h>
+
+#include "execute.h"
+
+#define MAX_BREAKPOINTS 64
+
+int set_breakpoint(uint32_t pc);
+int set_breakpoint_at_label(char *label);
+int remove_breakpoint(uint32_t pc);
+int remove_breakpoint_at_label(char *label);
+void clear_breakpoints();
+void reload_program();
+
+int add_watchpoint(int index);
+int remove_watchpoint(int index);
+int get_watchpoint_hit(int *index, int *old_value, int *new_value);
+
+void set_resume_pc(uint32_t pc);
+ExecResult debug_run(uint64_t budget);
+
+#endif // DEBUGGER_H
\ No newline at end of file
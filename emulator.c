@@ -8,4 +8,50 @@
 #include "instruction.h"
 #include "register.h"
 #include "execute.h"
-#include "assembler.h"
\ No newline at end of file
+#include "assembler.h"
+#include "memory.h"
+#include "optimizer.h"
+#include "profiler.h"
+#include "reverse.h"
+
+#include <stdio.h>
+
+/**
+ * Initializes the emulator: assembles the program and prepares it for execution.
+ * @param asm_file Filename of the file containing the assembly code
+ * @param optimize Run the optimizer over the program before execution if non zero
+ */
+void init_emulator(const char *asm_file, int optimize)
+{
+    set_profile_phase(PHASE_ASSEMBLE);
+    init_assembler(NULL, asm_file);
+    assemble();
+
+    set_profile_phase(PHASE_LOAD);
+    load_program();
+
+    // The data segment is mapped in place.
+    init_memory(data_segment, data_size);
+    set_register_by_name("$sp", INIT_SP);
+
+    // The optimizer needs the whole program, which lazy assembly does not encode.
+    if (optimize && !get_lazy_assembly())
+    {
+        int removed = optimize_program();
+        printf("Optimizer removed %d of %d instructions.\n", removed, instruction_count);
+    }
+    set_profile_phase(PHASE_NONE);
+}
+
+/**
+ * Runs the program from the current pc.
+ * @param budget Maximum number of instructions to execute, EXEC_UNLIMITED for no limit
+ * @return The result of the run
+ */
+ExecResult run_emulator(uint64_t budget)
+{
+    set_profile_phase(PHASE_EXECUTE);
+    ExecResult result = record_run(budget);
+    set_profile_phase(PHASE_NONE);
+    return result;
+}
\ No newline at end of file
@@ -1,4 +1,9 @@
 #ifndef EMULATOR_H
 #define EMULATOR_H
 
+#include "execute.h"
+
+void init_emulator(const char *asm_file, int optimize);
+ExecResult run_emulator(uint64_t budget);
+
 #endif // EMULATOR_H
\ No newline at end of file
@@ -1,7 +1,757 @@
 /**
  * Implementaion of the excecute module.
  * This module is responsible for executing the opcodes generated and stored by assembler modules.
+ * The bytecode is first decoded into an internal code stream, which the optimizer may rewrite.
+ * Every internal instruction remembers its index in bytecode[] so that results report real addresses.
+ * Instructions lazy assembly has not reached yet are OP_LAZY placeholders, which start a block and
+ * are assembled and decoded when a block starts at one.
  */
 #include "execute.h"
+#include "fuzz.h"
 #include "instruction.h"
+#include "memory.h"
 #include "register.h"
+#include "telemetry.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+ExecInstruction exec_code[MAX_NUM_INSTRUCTIONS];
+int exec_count = 0;
+
+// Maps an index in bytecode[] to the internal instruction executed at that address.
+int original_to_exec[MAX_NUM_INSTRUCTIONS + 1];
+
+// Number of instructions from each instruction up to and including the next control transfer, and
+// the number of program instructions they stand for.
+static uint32_t block_remaining[MAX_NUM_INSTRUCTIONS];
+static uint32_t block_weight[MAX_NUM_INSTRUCTIONS];
+
+// Charge every instruction as its own block, see set_block_stepping().
+static int block_stepping = 0;
+
+// Blocks entered since the last telemetry update.
+static uint32_t telemetry_blocks = 0;
+
+// Status requested by request_stop(), possibly from another thread. EXEC_HALTED means none.
+static atomic_int stop_requested = EXEC_HALTED;
+
+/**
+ * Decodes a single bytecode into an internal instruction.
+ * The destination register is always stored in rd and branch targets are resolved to indices.
+ * @param word The bytecode to decode
+ * @param index The index of the bytecode in bytecode[]
+ * @param instruction The internal instruction to fill in
+ */
+static void decode_exec_instruction(uint32_t word, int index, ExecInstruction *instruction)
+{
+    int id = decode_instruction(word);
+    if (id == -1)
+    {
+        printf("Error: Unknown bytecode 0x%08x at 0x%08x.\n", word, INIT_PC + index * 4);
+        exit(1);
+    }
+
+    instruction->op = id;
+    instruction->weight = 1;
+    instruction->rs = (word >> 21) & 0x1F;
+    instruction->rt = (word >> 16) & 0x1F;
+    instruction->rd = (word >> 11) & 0x1F;
+    instruction->imm = (int16_t)(word & 0xFFFF);
+    instruction->target = -1;
+    instruction->original_index = index;
+
+    switch (id)
+    {
+    case INSTR_SLL:
+    case INSTR_SRL:
+    case INSTR_SRA:
+        instruction->imm = (word >> 6) & 0x1F;
+        break;
+
+    case INSTR_ANDI:
+    case INSTR_ORI:
+        instruction->imm = word & 0xFFFF;
+        instruction->rd = instruction->rt;
+        break;
+
+    case INSTR_ADDI:
+    case INSTR_SUBI:
+        instruction->rd = instruction->rt;
+        break;
+
+    case INSTR_LUI:
+        instruction->imm = (word & 0xFFFF) << 16;
+        instruction->rd = instruction->rt;
+        break;
+
+    case INSTR_LB:
+    case INSTR_LBU:
+    case INSTR_LH:
+    case INSTR_LHU:
+    case INSTR_LW:
+        instruction->rd = instruction->rt;
+        break;
+
+    case INSTR_BEQ:
+    case INSTR_BNE:
+    case INSTR_BLEZ:
+    case INSTR_BGTZ:
+        instruction->target = index + 1 + instruction->imm;
+        break;
+
+    case INSTR_J:
+    case INSTR_JAL:
+    {
+        uint32_t address = ((word & 0x3FFFFFF) << 2) | (INIT_PC & 0xF0000000);
+        instruction->target = (int)((address - INIT_PC) / 4);
+        instruction->rd = (id == INSTR_JAL) ? 31 : 0;
+        break;
+    }
+    }
+
+    // Targets outside the program, e.g. in patched bytecode, fault when they are taken.
+    if ((id == INSTR_BEQ || id == INSTR_BNE || id == INSTR_BLEZ || id == INSTR_BGTZ || id == INSTR_J || id == INSTR_JAL) &&
+        (instruction->target < 0 || instruction->target > instruction_count))
+        instruction->target = -1;
+}
+
+/**
+ * Decodes bytecode[] into the internal code stream, one internal instruction per bytecode.
+ */
+void load_program()
+{
+    update_telemetry();
+    for (int i = 0; i < instruction_count; i++)
+    {
+        if (is_instruction_encoded(i))
+            decode_exec_instruction(bytecode[i], i, &exec_code[i]);
+        else
+            exec_code[i] = (ExecInstruction){OP_LAZY, 0, 0, 0, 1, 0, -1, i};
+        original_to_exec[i] = i;
+    }
+    exec_count = instruction_count;
+    original_to_exec[instruction_count] = instruction_count;
+
+    update_blocks();
+}
+
+/**
+ * Checks if an internal instruction may transfer control.
+ */
+static int ends_block(const ExecInstruction *instruction)
+{
+    switch (instruction->op)
+    {
+    case INSTR_BEQ:
+    case INSTR_BNE:
+    case INSTR_BLEZ:
+    case INSTR_BGTZ:
+    case INSTR_J:
+    case INSTR_JAL:
+    case INSTR_JR:
+    case INSTR_JALR:
+    case OP_BREAK:
+    case OP_LAZY:
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Checks if the block containing an internal instruction ends with it. Blocks also end before a
+ * placeholder, so that placeholders are only reached at the start of a block.
+ */
+static int is_block_end(int index)
+{
+    return ends_block(&exec_code[index]) || block_stepping ||
+           (index + 1 < exec_count && exec_code[index + 1].op == OP_LAZY);
+}
+
+/**
+ * Recomputes the basic block lengths used to charge the instruction budget.
+ * Must be called whenever exec_code changes.
+ */
+void update_blocks()
+{
+    update_telemetry();
+
+    uint32_t remaining = 0;
+    uint32_t weight = 0;
+    for (int i = exec_count - 1; i >= 0; i--)
+    {
+        if (is_block_end(i))
+        {
+            remaining = 0;
+            weight = 0;
+        }
+        block_remaining[i] = ++remaining;
+        weight += exec_code[i].weight;
+        block_weight[i] = weight;
+    }
+}
+
+/**
+ * Assembles and decodes the placeholders from a placeholder on, as far as assemble_lazy() goes, and
+ * extends the blocks that now run into them. Lazy mode maps every instruction to itself, so bytecode
+ * and internal indices are the same. A placeholder a removed breakpoint put back may already be
+ * encoded, then only it is decoded.
+ * @param index The index of the placeholder
+ */
+static void assemble_placeholders(int index)
+{
+    update_telemetry();
+
+    int first = index;
+    int end = is_instruction_encoded(index) ? index + 1 : assemble_lazy(index, &first);
+    // Breakpoints patched over placeholders keep them until they are removed.
+    for (int i = first; i < end; i++)
+        if (exec_code[i].op == OP_LAZY)
+            decode_exec_instruction(bytecode[i], i, &exec_code[i]);
+
+    // Only the block lengths up to end and back to the previous block end change.
+    uint32_t remaining = end < exec_count ? block_remaining[end] : 0;
+    uint32_t weight = end < exec_count ? block_weight[end] : 0;
+    for (int i = end - 1; i >= 0; i--)
+    {
+        if (is_block_end(i))
+        {
+            if (i < first)
+                break;
+            remaining = 0;
+            weight = 0;
+        }
+        block_remaining[i] = ++remaining;
+        weight += exec_code[i].weight;
+        block_weight[i] = weight;
+    }
+}
+
+/**
+ * Get the number of instructions charged when a block starts at an internal instruction.
+ */
+uint32_t get_block_length(int index)
+{
+    return block_remaining[index];
+}
+
+/**
+ * Makes every instruction a block of its own, so that stop requests take effect after the current
+ * instruction. Only used while it is needed, since it checks for stops after every instruction.
+ * @param enabled 1 to charge single instructions, 0 to charge whole blocks
+ */
+void set_block_stepping(int enabled)
+{
+    block_stepping = enabled;
+    update_blocks();
+}
+
+/**
+ * Asks a running execute() to stop at the next block boundary. Safe to call from any thread.
+ */
+void request_stop()
+{
+    request_stop_with_status(EXEC_STOPPED);
+}
+
+/**
+ * Asks a running execute() to stop at the next block boundary and return the given status.
+ * @param status The status execute() returns
+ */
+void request_stop_with_status(ExecStatus status)
+{
+    atomic_store_explicit(&stop_requested, status, memory_order_relaxed);
+}
+
+/**
+ * Get the original address of an internal instruction.
+ * @param index The index of the internal instruction
+ * @return The address of the instruction in the assembled program
+ */
+uint32_t get_original_pc(int index)
+{
+    if (index >= exec_count)
+        return INIT_PC + instruction_count * 4;
+
+    return INIT_PC + exec_code[index].original_index * 4;
+}
+
+/**
+ * Get the address of the first program instruction an internal instruction stands for. The optimizer
+ * merges removed instructions into the next kept one, so they precede it in bytecode[].
+ * @param index The index of the internal instruction
+ * @return The address execution resumes at when the instruction has not run yet
+ */
+static uint32_t get_first_pc(int index)
+{
+    if (index >= exec_count)
+        return INIT_PC + instruction_count * 4;
+
+    return INIT_PC + (exec_code[index].original_index - exec_code[index].weight + 1) * 4;
+}
+
+/**
+ * Get the internal instruction executed at an address.
+ * @param pc The address in the assembled program
+ * @return The index of the internal instruction, or -1 if the address is outside the program
+ */
+int get_exec_index(uint32_t pc)
+{
+    if (pc < INIT_PC || pc > (uint32_t)(INIT_PC + instruction_count * 4) || pc % 4 != 0)
+        return -1;
+
+    return original_to_exec[(pc - INIT_PC) / 4];
+}
+
+/**
+ * Print the internal code stream with the original addresses.
+ */
+void print_program()
+{
+    for (int i = 0; i < exec_count; i++)
+    {
+        ExecInstruction *instruction = &exec_code[i];
+        const char *name = get_instruction_name(instruction->op);
+        if (instruction->op == OP_LI)
+            name = "li";
+        else if (instruction->op == OP_MOVE)
+            name = "move";
+        else if (instruction->op == OP_NOP)
+            name = "nop";
+        else if (instruction->op == OP_BREAK)
+            name = "break";
+        else if (instruction->op == OP_LAZY)
+            name = "lazy";
+
+        printf("%4d  0x%08x  %-5s rd=%-2d rs=%-2d rt=%-2d imm=%d", i, get_original_pc(i), name,
+               instruction->rd, instruction->rs, instruction->rt, instruction->imm);
+        if (instruction->target != -1)
+            printf(" -> %d", instruction->target);
+        printf("\n");
+    }
+}
+
+/**
+ * Write a register, ignoring writes to $zero.
+ */
+static void write_register(int index, int value)
+{
+    if (index != 0)
+        set_register_by_index(index, value);
+}
+
+/**
+ * Write hi and lo.
+ */
+static void write_hilo(int hi, int lo)
+{
+    set_hi(hi);
+    set_lo(lo);
+}
+
+/**
+ * Write guest memory. The address was checked by the executor.
+ */
+static void write_memory(uint32_t address, int size, uint32_t value)
+{
+    store_memory(address, size, value);
+}
+
+/**
+ * Get the number of bytes a load or store accesses.
+ */
+int get_access_size(int op)
+{
+    switch (op)
+    {
+    case INSTR_LB:
+    case INSTR_LBU:
+    case INSTR_SB:
+        return 1;
+    case INSTR_LH:
+    case INSTR_LHU:
+    case INSTR_SH:
+        return 2;
+    }
+    return 4;
+}
+
+// Handlers used by the executor for register writes. The base handler stores the value, the
+// register writer may check the write first and then call store_register().
+static RegisterWriter base_register_writer = write_register;
+static RegisterWriter register_writer = write_register;
+static HiLoWriter hilo_writer = write_hilo;
+static MemoryWriter memory_writer = write_memory;
+
+// Called at the start of every block, see set_block_hook().
+static BlockHook block_hook = NULL;
+
+// Instructions retired by all runs.
+uint64_t exec_time = 0;
+
+// Internal instruction starting the block being executed, or -1 outside execute(). Read by the
+// profiler from a signal handler.
+volatile sig_atomic_t current_block = -1;
+
+/**
+ * Replaces the handler used for register writes, e.g. by one checking watchpoints.
+ * @param writer The new handler, or NULL to restore the base handler
+ */
+void set_register_writer(RegisterWriter writer)
+{
+    register_writer = writer != NULL ? writer : base_register_writer;
+}
+
+/**
+ * Replaces the handler that stores register values, e.g. by one logging the old values.
+ * @param writer The new handler, or NULL to restore the default handler
+ */
+void set_base_register_writer(RegisterWriter writer)
+{
+    if (register_writer == base_register_writer)
+        register_writer = writer != NULL ? writer : write_register;
+    base_register_writer = writer != NULL ? writer : write_register;
+}
+
+/**
+ * Replaces the handler used for writes to hi and lo.
+ * @param writer The new handler, or NULL to restore the default handler
+ */
+void set_hilo_writer(HiLoWriter writer)
+{
+    hilo_writer = writer != NULL ? writer : write_hilo;
+}
+
+/**
+ * Replaces the handler used for stores to guest memory, e.g. by one logging the old values.
+ * @param writer The new handler, or NULL to restore the default handler
+ */
+void set_memory_writer(MemoryWriter writer)
+{
+    memory_writer = writer != NULL ? writer : write_memory;
+}
+
+/**
+ * Stores a register value through the base handler.
+ */
+void store_register(int index, int value)
+{
+    base_register_writer(index, value);
+}
+
+/**
+ * Sets a function called at the start of every executed block with the index of its first
+ * instruction and the exec_time at that point.
+ * @param hook The function, or NULL to remove it
+ */
+void set_block_hook(BlockHook hook)
+{
+    block_hook = hook;
+}
+
+/**
+ * Get the number of program instructions a range of internal instructions stands for.
+ */
+static uint64_t get_range_weight(int first, int end)
+{
+    uint64_t weight = 0;
+    for (int i = first; i < end; i++)
+        weight += exec_code[i].weight;
+    return weight;
+}
+
+/**
+ * Executes the internal code stream from the current pc until the pc leaves the program, the budget
+ * is used up or a stop is requested.
+ * The budget is charged once per basic block and the stop request is only checked between blocks,
+ * so the instructions inside a block run without any checks. A block that does not fit in the
+ * remaining budget is cut short, so the retired count is exact. Budget and retired count are program
+ * instructions: an internal instruction the optimizer merged removed instructions into counts them too,
+ * and a block is cut before an internal instruction that does not fit as a whole. The pc is then the
+ * first instruction the cut one stands for, while a fault retires the instructions merged into the
+ * faulting one and reports its own pc. Only when the first instruction of a run does not fit, it runs
+ * anyway and the run retires more than its budget.
+ * @param budget Maximum number of instructions to execute, EXEC_UNLIMITED for no limit
+ * @return The status of the run, the number of executed instructions and the final pc
+ */
+ExecResult execute(uint64_t budget)
+{
+    ExecResult result = {EXEC_HALTED, 0, 0};
+    uint64_t remaining = budget;
+    uint64_t count = 0;
+    int block_end = 0; // Index after the last instruction charged for the current block
+
+    int index = get_exec_index(get_pc());
+    if (index == -1)
+    {
+        result.status = EXEC_FAULT;
+        result.pc = get_pc();
+        return result;
+    }
+
+    // A taken branch to a target outside the program leaves a negative index.
+    while ((unsigned)index < (unsigned)exec_count)
+    {
+        if (atomic_load_explicit(&stop_requested, memory_order_relaxed) != EXEC_HALTED)
+        {
+            result.status = atomic_exchange_explicit(&stop_requested, EXEC_HALTED, memory_order_relaxed);
+            break;
+        }
+
+        if (exec_code[index].op == OP_LAZY)
+            assemble_placeholders(index);
+
+        // Charge the whole block up front.
+        count = block_remaining[index];
+        uint64_t weight = block_weight[index];
+        if (weight > remaining)
+        {
+            weight = 0;
+            for (count = 0; weight + exec_code[index + count].weight <= remaining; count++)
+                weight += exec_code[index + count].weight;
+            if (count == 0 && (remaining != budget || remaining == 0))
+            {
+                result.status = EXEC_BUDGET_EXHAUSTED;
+                break;
+            }
+            if (count == 0)
+            {
+                // Nothing ran yet, so the budget grows to the first instruction instead of never making progress.
+                budget = remaining = weight = exec_code[index].weight;
+                count = 1;
+            }
+        }
+        current_block = index;
+        block_end = index + (int)count;
+        if (telemetry != NULL)
+        {
+            block_entries[index]++;
+            if (index < block_dirty_first)
+                block_dirty_first = index;
+            if (index + (int)block_remaining[index] > block_dirty_end)
+                block_dirty_end = index + (int)block_remaining[index];
+            for (uint32_t i = count; i < block_remaining[index]; i++)
+                block_unexecuted[index + i]++;
+            atomic_store_explicit(&telemetry->retired, exec_time + budget - remaining, memory_order_relaxed);
+            atomic_store_explicit(&telemetry->pc, get_first_pc(index), memory_order_relaxed);
+            if (++telemetry_blocks == TELEMETRY_FOLD_BLOCKS)
+            {
+                telemetry_blocks = 0;
+                update_telemetry();
+            }
+        }
+        if (coverage_map != NULL)
+        {
+            // AFL edge coverage: the block address hashed with the previous one, shifted so that
+            // both directions of an edge differ.
+            uint32_t location = ((uint32_t)exec_code[index].original_index * 0x9E3779B1u) >> 16;
+            uint32_t edge = (location ^ coverage_previous) & (COVERAGE_MAP_SIZE - 1);
+            if (coverage_map[edge]++ == 0 && coverage_touched_count < COVERAGE_MAP_SIZE)
+                coverage_touched[coverage_touched_count++] = edge;
+            coverage_previous = location >> 1;
+        }
+        if (block_hook != NULL)
+            block_hook(index, exec_time + budget - remaining);
+        remaining -= weight;
+
+        while (count > 0)
+        {
+            count--;
+            ExecInstruction *instruction = &exec_code[index++];
+            int rs = get_register_value(instruction->rs);
+            int rt = get_register_value(instruction->rt);
+
+            switch (instruction->op)
+            {
+            case INSTR_ADD:
+                register_writer(instruction->rd, (int)((uint32_t)rs + (uint32_t)rt));
+                break;
+            case INSTR_SUB:
+                register_writer(instruction->rd, (int)((uint32_t)rs - (uint32_t)rt));
+                break;
+            case INSTR_AND:
+                register_writer(instruction->rd, rs & rt);
+                break;
+            case INSTR_OR:
+                register_writer(instruction->rd, rs | rt);
+                break;
+            case INSTR_XOR:
+                register_writer(instruction->rd, rs ^ rt);
+                break;
+            case INSTR_NOR:
+                register_writer(instruction->rd, ~(rs | rt));
+                break;
+            case INSTR_ADDI:
+                register_writer(instruction->rd, (int)((uint32_t)rs + (uint32_t)instruction->imm));
+                break;
+            case INSTR_SUBI:
+                register_writer(instruction->rd, (int)((uint32_t)rs - (uint32_t)instruction->imm));
+                break;
+            case INSTR_ANDI:
+                register_writer(instruction->rd, rs & instruction->imm);
+                break;
+            case INSTR_ORI:
+                register_writer(instruction->rd, rs | instruction->imm);
+                break;
+            case INSTR_SLL:
+                register_writer(instruction->rd, (int)((uint32_t)rt << instruction->imm));
+                break;
+            case INSTR_SRL:
+                register_writer(instruction->rd, (int)((uint32_t)rt >> instruction->imm));
+                break;
+            case INSTR_SRA:
+                register_writer(instruction->rd, rt >> instruction->imm);
+                break;
+            case INSTR_SLT:
+                register_writer(instruction->rd, rs < rt);
+                break;
+            case INSTR_LUI:
+                register_writer(instruction->rd, instruction->imm);
+                break;
+            case INSTR_MFHI:
+                register_writer(instruction->rd, get_hi());
+                break;
+            case INSTR_MFLO:
+                register_writer(instruction->rd, get_lo());
+                break;
+            case INSTR_MULT:
+            {
+                int64_t product = (int64_t)rs * (int64_t)rt;
+                hilo_writer((int)(product >> 32), (int)product);
+                break;
+            }
+            case INSTR_DIV:
+                // Division by zero and overflow leave hi and lo unchanged.
+                if (rt != 0 && !(rs == INT32_MIN && rt == -1))
+                {
+                    hilo_writer(rs % rt, rs / rt);
+                }
+                break;
+            case INSTR_BEQ:
+                if (rs == rt)
+                    index = instruction->target;
+                break;
+            case INSTR_BNE:
+                if (rs != rt)
+                    index = instruction->target;
+                break;
+            case INSTR_BLEZ:
+                if (rs <= 0)
+                    index = instruction->target;
+                break;
+            case INSTR_BGTZ:
+                if (rs > 0)
+                    index = instruction->target;
+                break;
+            case INSTR_J:
+                index = instruction->target;
+                break;
+            case INSTR_JAL:
+                register_writer(instruction->rd, INIT_PC + (instruction->original_index + 1) * 4);
+                index = instruction->target;
+                break;
+            case INSTR_JR:
+            case INSTR_JALR:
+            {
+                int target = get_exec_index(rs);
+                if (target == -1)
+                    goto fault;
+                register_writer(instruction->rd, INIT_PC + (instruction->original_index + 1) * 4);
+                index = target;
+                break;
+            }
+            case INSTR_LB:
+            case INSTR_LBU:
+            case INSTR_LH:
+            case INSTR_LHU:
+            case INSTR_LW:
+            {
+                uint32_t value;
+                if (load_memory((uint32_t)rs + (uint32_t)instruction->imm, get_access_size(instruction->op), &value) != 0)
+                    goto fault;
+                if (instruction->op == INSTR_LB)
+                    value = (int8_t)value;
+                else if (instruction->op == INSTR_LH)
+                    value = (int16_t)value;
+                register_writer(instruction->rd, (int)value);
+                break;
+            }
+            case INSTR_SB:
+            case INSTR_SH:
+            case INSTR_SW:
+            {
+                uint32_t address = (uint32_t)rs + (uint32_t)instruction->imm;
+                int size = get_access_size(instruction->op);
+                if (address % size != 0 || get_memory_pointer(address, size) == NULL)
+                    goto fault;
+                memory_writer(address, size, (uint32_t)rt);
+                break;
+            }
+            case OP_LI:
+                register_writer(instruction->rd, instruction->imm);
+                break;
+            case OP_MOVE:
+                register_writer(instruction->rd, rs);
+                break;
+            case OP_NOP:
+                break;
+            case OP_BREAK:
+                // The breakpoint is not retired, the pc stays on it.
+                result.status = EXEC_BREAKPOINT;
+                index--;
+                remaining += get_range_weight(index, block_end);
+                if (telemetry != NULL)
+                    for (uint64_t i = 0; i <= count; i++)
+                        block_unexecuted[index + i]++;
+                goto stop;
+            case OP_LAZY:
+                // A placeholder a removed breakpoint put back inside a block. The block ends before
+                // it, and the next block starts at it and assembles it.
+                index--;
+                remaining += get_range_weight(index, block_end);
+                if (telemetry != NULL)
+                    for (uint64_t i = 0; i <= count; i++)
+                        block_unexecuted[index + i]++;
+                count = 0;
+                break;
+            }
+        }
+    }
+    if (index < 0 || index > exec_count)
+    {
+        // Only the last instruction of a block transfers control, so it is the faulting one.
+        index = block_end;
+        count = 0;
+        goto fault;
+    }
+    goto stop;
+
+fault:
+    // The faulting instruction and the rest of the block are not retired. The removed instructions
+    // merged into the faulting one ran before it, so they are.
+    result.status = EXEC_FAULT;
+    index--;
+    remaining += 1 + get_range_weight(index + 1, block_end);
+    if (telemetry != NULL)
+    {
+        faulted_opcodes[decode_instruction(bytecode[exec_code[index].original_index])]++;
+        for (uint64_t i = 1; i <= count; i++)
+            block_unexecuted[index + i]++;
+    }
+
+stop:
+    current_block = -1;
+    result.retired = budget - remaining;
+    exec_time += result.retired;
+    result.pc = result.status == EXEC_FAULT ? get_original_pc(index) : get_first_pc(index);
+    set_pc((result.pc - INIT_PC) / 4);
+
+    if (telemetry != NULL)
+    {
+        atomic_store_explicit(&telemetry->retired, exec_time, memory_order_relaxed);
+        atomic_store_explicit(&telemetry->pc, result.pc, memory_order_relaxed);
+        refresh_telemetry();
+    }
+    return result;
+}
@@ -1,6 +1,84 @@
+/**
+ * Header file for the excecute module.
+ * The bytecode is decoded into an internal code stream which is then executed.
+ */
 #ifndef EXCECUTE_H
 #define EXCECUTE_H
 
+#include <signal.h>
+#include <stdint.h>
 
+#include "assembler.h"
+#include "instruction.h"
+
+// Internal operations. Instructions keep their InstructionId, the optimizer adds the rest.
+typedef enum exec_op
+{
+    OP_LI = NUM_INSTRUCTIONS, // rd = imm
+    OP_MOVE,                  // rd = rs
+    OP_NOP,
+    OP_BREAK,                 // Breakpoint patched over an instruction
+    OP_LAZY,                  // Instruction not assembled yet, see assemble_lazy()
+    NUM_EXEC_OPS
+} ExecOp;
+
+// A decoded instruction of the internal code stream.
+typedef struct exec_instruction
+{
+    uint16_t op;
+    uint8_t rd, rs, rt;
+    uint8_t weight;     // Instructions of the program it stands for, the last one is original_index
+    int32_t imm;        // Immediate, shift amount or constant
+    int target;         // Internal index of the branch or jump target
+    int original_index; // Index of the instruction in bytecode[]
+} ExecInstruction;
+
+typedef enum exec_status
+{
+    EXEC_HALTED,           // The pc left the program
+    EXEC_FAULT,            // Jump to an address outside the program or invalid memory access
+    EXEC_BUDGET_EXHAUSTED, // The instruction budget ran out
+    EXEC_STOPPED,          // request_stop() was called
+    EXEC_BREAKPOINT,       // A breakpoint was reached, the pc is the breakpoint address
+    EXEC_WATCHPOINT,       // A watched register changed
+} ExecStatus;
+
+typedef void (*RegisterWriter)(int index, int value);
+typedef void (*HiLoWriter)(int hi, int lo);
+typedef void (*MemoryWriter)(uint32_t address, int size, uint32_t value);
+typedef void (*BlockHook)(int index, uint64_t time);
+
+#define EXEC_UNLIMITED UINT64_MAX
+
+typedef struct exec_result
+{
+    ExecStatus status;
+    uint64_t retired; // Number of program instructions executed, including those the optimizer merged
+    uint32_t pc;      // Original address of the next instruction
+} ExecResult;
+
+extern ExecInstruction exec_code[MAX_NUM_INSTRUCTIONS];
+extern int exec_count;
+extern int original_to_exec[MAX_NUM_INSTRUCTIONS + 1];
+extern uint64_t exec_time;
+extern volatile sig_atomic_t current_block;
+
+void load_program();
+void print_program();
+uint32_t get_original_pc(int index);
+int get_exec_index(uint32_t pc);
+void update_blocks();
+uint32_t get_block_length(int index);
+int get_access_size(int op);
+void set_block_stepping(int enabled);
+void set_register_writer(RegisterWriter writer);
+void set_base_register_writer(RegisterWriter writer);
+void set_hilo_writer(HiLoWriter writer);
+void set_memory_writer(MemoryWriter writer);
+void store_register(int index, int value);
+void set_block_hook(BlockHook hook);
+void request_stop();
+void request_stop_with_status(ExecStatus status);
+ExecResult execute(uint64_t budget);
 
 #endif // EXCECUTE_H
\ No newline at end of file
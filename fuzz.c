@@ -0,0 +1,483 @@
+/**
+ * Implementation of the fuzzing module.
+ * The routine under test is entered at a label with the input in $a0 to $a3 and $ra pointing just
+ * past the program, so returning from it halts the executor. Before each input the registers are set
+ * again and only the memory pages the previous input wrote are restored, which the memory writer
+ * tracks, so a reset costs a few stores instead of a new process.
+ * Coverage is recorded by the executor at the start of every block as in AFL: the edge from the
+ * previous block to the current one increments one counter of the bitmap. When the emulator runs
+ * under AFL the bitmap is AFL's shared memory and the process serves AFL's fork server, whose
+ * children run many inputs each as in AFL's persistent mode. Otherwise the bitmap is local to this
+ * process and feeds the built-in mutation loop, which keeps every input that reaches a new edge or hit
+ * count bucket.
+ */
+#include "fuzz.h"
+#include "assembler.h"
+#include "emulator.h"
+#include "execute.h"
+#include "memory.h"
+#include "register.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/shm.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#define FIRST_ARGUMENT_REGISTER 4  // $a0
+#define STACK_POINTER_REGISTER 29  // $sp
+#define RETURN_ADDRESS_REGISTER 31 // $ra
+#define FUZZ_MAX_CORPUS 4096
+#define FUZZ_MAX_REPORTS 16 // Distinct crash and hang sites reported
+#define FUZZ_PERSISTENT_RUNS 10000 // Inputs run by one child of the fork server
+#define FORK_SERVER_FD 198         // AFL's control pipe, the status pipe is the next descriptor
+
+uint8_t *coverage_map = NULL;
+uint32_t coverage_previous = 0;
+
+// Entries of coverage_map that became non zero since the map was last cleared.
+uint32_t coverage_touched[COVERAGE_MAP_SIZE];
+uint32_t coverage_touched_count = 0;
+
+static uint8_t local_map[COVERAGE_MAP_SIZE];
+
+static uint32_t entry_address;
+static uint32_t return_address;
+static uint64_t fuzz_budget;
+static uint32_t last_pc;
+
+// Data segment as assembled, and the pages written since the last reset.
+static uint8_t *pristine_data = NULL;
+static uint32_t pristine_size = 0;
+static uint8_t *page_dirty = NULL;
+static int *dirty_pages = NULL;
+static int dirty_count = 0;
+
+static uint64_t random_state;
+
+/**
+ * Stores to guest memory, remembering the page for the next reset.
+ */
+static void write_memory_tracked(uint32_t address, int size, uint32_t value)
+{
+    int page = get_memory_page(address);
+    if (!page_dirty[page])
+    {
+        page_dirty[page] = 1;
+        dirty_pages[dirty_count++] = page;
+    }
+    store_memory(address, size, value);
+}
+
+/**
+ * Restores the pages written since the last reset: data pages from the assembled data segment,
+ * stack pages to zero.
+ */
+static void restore_memory()
+{
+    for (int i = 0; i < dirty_count; i++)
+    {
+        int page = dirty_pages[i];
+        uint32_t address = get_memory_page_address(page);
+        uint8_t *pointer = get_memory_pointer(address, MEMORY_PAGE_SIZE);
+        if (address - DATA_SEGMENT_START < pristine_size)
+            memcpy(pointer, pristine_data + (address - DATA_SEGMENT_START), MEMORY_PAGE_SIZE);
+        else
+            memset(pointer, 0, MEMORY_PAGE_SIZE);
+        page_dirty[page] = 0;
+    }
+    dirty_count = 0;
+}
+
+/**
+ * Get the coverage bitmap: AFL's shared memory if __AFL_SHM_ID names one, otherwise a local map.
+ * @return The bitmap, or NULL if the shared memory cannot be attached
+ */
+static uint8_t *attach_coverage_map()
+{
+    const char *id = getenv("__AFL_SHM_ID");
+    if (id == NULL)
+        return local_map;
+
+#ifdef _WIN32
+    fprintf(stderr, "Warning: AFL shared memory is not supported on Windows, coverage stays local.\n");
+    return local_map;
+#else
+    void *map = shmat(atoi(id), NULL, 0);
+    if (map == (void *)-1)
+    {
+        fprintf(stderr, "Error: Could not attach AFL shared memory %s.\n", id);
+        return NULL;
+    }
+    return (uint8_t *)map;
+#endif
+}
+
+/**
+ * Assembles the program and prepares fuzzing the routine at a label.
+ * @param asm_file Filename of the file containing the assembly code
+ * @param entry_label The label of the routine, which returns with jr $ra
+ * @param budget Instructions per input before the run counts as a hang
+ * @param optimize Run the optimizer over the program if non zero
+ * @return 0 on success, -1 if the label is not an instruction or the bitmap cannot be attached
+ */
+int init_fuzzer(const char *asm_file, const char *entry_label, uint64_t budget, int optimize)
+{
+    init_emulator(asm_file, optimize);
+
+    if (get_label_address_by_name((char *)entry_label, &entry_address) == -1 ||
+        entry_address < INIT_PC || entry_address >= (uint32_t)(INIT_PC + instruction_count * 4))
+    {
+        fprintf(stderr, "Error: %s is not a label of an instruction.\n", entry_label);
+        return -1;
+    }
+    return_address = INIT_PC + instruction_count * 4;
+    fuzz_budget = budget;
+
+    coverage_map = attach_coverage_map();
+    if (coverage_map == NULL)
+        return -1;
+    coverage_previous = 0;
+    coverage_touched_count = 0;
+
+    pristine_size = (data_size + MEMORY_PAGE_SIZE - 1) & ~(uint32_t)(MEMORY_PAGE_SIZE - 1);
+    pristine_data = (uint8_t *)malloc(pristine_size + 1);
+    page_dirty = (uint8_t *)calloc(get_memory_page_count(), 1);
+    dirty_pages = (int *)malloc(get_memory_page_count() * sizeof(int));
+    if (pristine_data == NULL || page_dirty == NULL || dirty_pages == NULL)
+    {
+        printf("Error: Could not allocate the fuzzing state.\n");
+        exit(1);
+    }
+    if (pristine_size > 0)
+        memcpy(pristine_data, get_memory_pointer(DATA_SEGMENT_START, pristine_size), pristine_size);
+    dirty_count = 0;
+
+    set_memory_writer(write_memory_tracked);
+    return 0;
+}
+
+/**
+ * Runs the routine on one input, after resetting the guest state.
+ * @param input The input, big endian words for $a0 to $a3. Missing bytes are zero, extra bytes are
+ *              ignored.
+ * @param size The size of the input
+ * @return The outcome of the run
+ */
+FuzzOutcome fuzz_one(const uint8_t *input, size_t size)
+{
+    restore_memory();
+
+    for (int i = 1; i < REGISTER_TABLE_SIZE; i++)
+        set_register_by_index(i, 0);
+    for (int i = 0; i < FUZZ_INPUT_SIZE / 4; i++)
+    {
+        uint32_t value = 0;
+        for (int j = 0; j < 4; j++)
+            value = (value << 8) | (i * 4 + j < (int)size ? input[i * 4 + j] : 0);
+        set_register_by_index(FIRST_ARGUMENT_REGISTER + i, (int)value);
+    }
+    set_register_by_index(STACK_POINTER_REGISTER, INIT_SP);
+    set_register_by_index(RETURN_ADDRESS_REGISTER, return_address);
+    set_hi(0);
+    set_lo(0);
+    set_pc((entry_address - INIT_PC) / 4);
+    coverage_previous = 0;
+
+    ExecResult result = execute(fuzz_budget);
+    last_pc = result.pc;
+
+    if (result.status == EXEC_FAULT)
+        return FUZZ_CRASH;
+    if (result.status == EXEC_BUDGET_EXHAUSTED)
+        return FUZZ_HANG;
+    return FUZZ_OK;
+}
+
+/**
+ * Runs the routine once on the input read from stdin.
+ * @return The outcome of the run
+ */
+int fuzz_stdin()
+{
+    uint8_t input[FUZZ_INPUT_SIZE];
+    size_t size = fread(input, 1, sizeof(input), stdin);
+    FuzzOutcome outcome = fuzz_one(input, size);
+    if (outcome != FUZZ_OK)
+    {
+        printf("%s at 0x%08x\n", outcome == FUZZ_CRASH ? "Crash" : "Hang", last_pc);
+        fflush(stdout);
+    }
+    return outcome;
+}
+
+#ifndef _WIN32
+// AFL looks for this string in the binary to run it in persistent mode.
+static const char *volatile persistent_signature = "##SIG_AFL_PERSISTENT##";
+
+/**
+ * Serves AFL's fork server. The parent stays here and forks a child for AFL, or lets the stopped child
+ * continue with the next input, and reports the status of the child after every input.
+ * @return 1 in the child, 0 if AFL does not run a fork server
+ */
+static int start_fork_server()
+{
+    uint32_t message = 0;
+    if (write(FORK_SERVER_FD + 1, &message, 4) != 4)
+        return 0;
+
+    pid_t child = -1;
+    int child_stopped = 0;
+    for (;;)
+    {
+        uint32_t was_killed;
+        if (read(FORK_SERVER_FD, &was_killed, 4) != 4)
+            _exit(1);
+
+        // AFL killed the stopped child after a timeout.
+        if (child_stopped && was_killed)
+        {
+            child_stopped = 0;
+            if (waitpid(child, NULL, 0) < 0)
+                _exit(1);
+        }
+
+        if (child_stopped)
+        {
+            kill(child, SIGCONT);
+            child_stopped = 0;
+        }
+        else
+        {
+            child = fork();
+            if (child < 0)
+                _exit(1);
+            if (child == 0)
+            {
+                close(FORK_SERVER_FD);
+                close(FORK_SERVER_FD + 1);
+                return 1;
+            }
+        }
+
+        int status;
+        message = (uint32_t)child;
+        if (write(FORK_SERVER_FD + 1, &message, 4) != 4 || waitpid(child, &status, WUNTRACED) < 0)
+            _exit(1);
+        child_stopped = WIFSTOPPED(status);
+        message = (uint32_t)status;
+        if (write(FORK_SERVER_FD + 1, &message, 4) != 4)
+            _exit(1);
+    }
+}
+#endif
+
+/**
+ * Runs the inputs AFL writes to stdin, so that AFL does not start and assemble a process per input.
+ * Each child of the fork server runs up to FUZZ_PERSISTENT_RUNS inputs and stops itself after each
+ * one until AFL has written the next. A crash aborts the child like a crash of a native target.
+ * Without a fork server one input is run.
+ */
+void fuzz_afl()
+{
+    int runs = 1;
+#ifndef _WIN32
+    if (persistent_signature[0] != '\0' && start_fork_server())
+        runs = FUZZ_PERSISTENT_RUNS;
+#endif
+
+    for (int run = 0; run < runs; run++)
+    {
+#ifndef _WIN32
+        if (run > 0)
+        {
+            raise(SIGSTOP);
+            rewind(stdin);
+        }
+#endif
+        // AFL clears the bitmap itself.
+        coverage_touched_count = 0;
+        if (fuzz_stdin() == FUZZ_CRASH)
+            abort();
+    }
+}
+
+/**
+ * Reduces a hit count to its AFL bucket: 1, 2, 3, 4-7, 8-15, 16-31, 32-127 or 128-255 hits.
+ */
+static uint8_t get_bucket(uint8_t count)
+{
+    if (count <= 2)
+        return count;
+    if (count == 3)
+        return 4;
+    if (count < 8)
+        return 8;
+    if (count < 16)
+        return 16;
+    if (count < 32)
+        return 32;
+    if (count < 128)
+        return 64;
+    return 128;
+}
+
+/**
+ * Compares the coverage of the last run with all earlier runs and clears the map for the next run.
+ * Only the touched entries are visited, so the cost does not depend on the size of the map.
+ * @param virgin The buckets not seen yet for every entry, updated
+ * @return 1 if the run reached a new entry or bucket, 0 otherwise
+ */
+static int merge_coverage(uint8_t *virgin)
+{
+    int found = 0;
+    for (uint32_t i = 0; i < coverage_touched_count; i++)
+    {
+        uint32_t entry = coverage_touched[i];
+        uint8_t bucket = get_bucket(coverage_map[entry]);
+        if (bucket & virgin[entry])
+        {
+            virgin[entry] &= ~bucket;
+            found = 1;
+        }
+        coverage_map[entry] = 0;
+    }
+    coverage_touched_count = 0;
+    return found;
+}
+
+static uint64_t next_random()
+{
+    // xorshift64*
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    return random_state * 0x2545F4914F6CDD1DULL;
+}
+
+static uint32_t get_word(const uint8_t *input, int word)
+{
+    return ((uint32_t)input[word * 4] << 24) | ((uint32_t)input[word * 4 + 1] << 16) |
+           ((uint32_t)input[word * 4 + 2] << 8) | input[word * 4 + 3];
+}
+
+static void set_word(uint8_t *input, int word, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        input[word * 4 + i] = (uint8_t)(value >> (24 - i * 8));
+}
+
+/**
+ * Applies one to four random mutations: bit flips, random bytes, small additions and interesting
+ * values to whole arguments, and arguments copied from another corpus entry.
+ */
+static void mutate(uint8_t *input, uint8_t (*corpus)[FUZZ_INPUT_SIZE], int corpus_count)
+{
+    static const uint32_t interesting[] = {
+        0, 1, 2, 0x10, 0x20, 0x40, 0x64, 0x7F, 0x80, 0xFF, 0x100, 0x400, 0x1000, 0x7FFF, 0x8000, 0xFFFF,
+        0x10000, 0x7FFFFFFF, 0x80000000, 0xFFFFFFFF, DATA_SEGMENT_START, INIT_SP};
+
+    int mutations = 1 + next_random() % 4;
+    for (int m = 0; m < mutations; m++)
+    {
+        uint64_t r = next_random();
+        int position = (r >> 8) % FUZZ_INPUT_SIZE;
+        int word = position / 4;
+
+        switch (r % 5)
+        {
+        case 0:
+            input[position] ^= 1 << ((r >> 16) % 8);
+            break;
+        case 1:
+            input[position] = (uint8_t)(r >> 24);
+            break;
+        case 2:
+            set_word(input, word, get_word(input, word) + (uint32_t)((int)((r >> 16) % 71) - 35));
+            break;
+        case 3:
+            set_word(input, word, interesting[(r >> 16) % (sizeof(interesting) / sizeof(interesting[0]))]);
+            break;
+        case 4:
+            set_word(input, word, get_word(corpus[(r >> 16) % corpus_count], (r >> 40) % (FUZZ_INPUT_SIZE / 4)));
+            break;
+        }
+    }
+}
+
+static double get_seconds()
+{
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Fuzzes the routine in this process: mutates inputs from the corpus, keeps those with new coverage
+ * and reports the first input crashing or hanging at each pc.
+ * @param runs Number of inputs to run
+ * @param seed Seed of the mutations
+ */
+void fuzz_loop(uint64_t runs, uint64_t seed)
+{
+    static uint8_t virgin[COVERAGE_MAP_SIZE];
+    static uint8_t corpus[FUZZ_MAX_CORPUS][FUZZ_INPUT_SIZE];
+    uint32_t report_pcs[FUZZ_MAX_REPORTS];
+    int report_count = 0;
+    uint64_t crashes = 0, hangs = 0;
+
+    memset(virgin, 0xFF, sizeof(virgin));
+    memset(corpus[0], 0, FUZZ_INPUT_SIZE);
+    int corpus_count = 1;
+    random_state = seed != 0 ? seed : 1;
+
+    // Coverage from before the loop is discarded.
+    memset(coverage_map, 0, COVERAGE_MAP_SIZE);
+    coverage_touched_count = 0;
+
+    double start = get_seconds();
+    for (uint64_t run = 0; run < runs; run++)
+    {
+        uint8_t input[FUZZ_INPUT_SIZE];
+        memcpy(input, corpus[next_random() % corpus_count], FUZZ_INPUT_SIZE);
+        if (run > 0)
+            mutate(input, corpus, corpus_count);
+
+        FuzzOutcome outcome = fuzz_one(input, FUZZ_INPUT_SIZE);
+        if (merge_coverage(virgin) && outcome == FUZZ_OK && corpus_count < FUZZ_MAX_CORPUS)
+            memcpy(corpus[corpus_count++], input, FUZZ_INPUT_SIZE);
+
+        if (outcome == FUZZ_OK)
+            continue;
+        if (outcome == FUZZ_CRASH)
+            crashes++;
+        else
+            hangs++;
+
+        int reported = 0;
+        for (int i = 0; i < report_count; i++)
+            reported |= report_pcs[i] == last_pc;
+        if (!reported && report_count < FUZZ_MAX_REPORTS)
+        {
+            report_pcs[report_count++] = last_pc;
+            printf("%s at 0x%08x with $a0=0x%08x $a1=0x%08x $a2=0x%08x $a3=0x%08x\n",
+                   outcome == FUZZ_CRASH ? "Crash" : "Hang", last_pc,
+                   get_word(input, 0), get_word(input, 1), get_word(input, 2), get_word(input, 3));
+        }
+    }
+    double seconds = get_seconds() - start;
+
+    int edges = 0;
+    for (int i = 0; i < COVERAGE_MAP_SIZE; i++)
+        edges += virgin[i] != 0xFF;
+
+    printf("\n%llu runs in %.2f s (%.0f runs/s), %d edges, corpus %d, %llu crashes, %llu hangs\n",
+           (unsigned long long)runs, seconds, seconds > 0 ? runs / seconds : 0.0, edges, corpus_count,
+           (unsigned long long)crashes, (unsigned long long)hangs);
+}
@@ -0,0 +1,36 @@
+/**
+ * Header file for the fuzzing module.
+ * This module runs a guest routine over many inputs in one process. The program is assembled once and
+ * the guest state is reset cheaply between inputs, while the executor records edge coverage into an
+ * AFL style bitmap.
+ */
+#ifndef FUZZ_H
+#define FUZZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define COVERAGE_MAP_SIZE 65536     // Entries of the coverage bitmap, a power of two like in AFL
+#define FUZZ_INPUT_SIZE 16          // Input bytes, filling $a0 to $a3
+#define DEFAULT_FUZZ_BUDGET 100000  // Instructions before a run counts as a hang
+#define DEFAULT_FUZZ_RUNS 1000000
+
+typedef enum fuzz_outcome
+{
+    FUZZ_OK,    // The routine returned
+    FUZZ_CRASH, // The routine faulted
+    FUZZ_HANG,  // The routine used up the instruction budget
+} FuzzOutcome;
+
+extern uint8_t *coverage_map;
+extern uint32_t coverage_previous;
+extern uint32_t coverage_touched[COVERAGE_MAP_SIZE];
+extern uint32_t coverage_touched_count;
+
+int init_fuzzer(const char *asm_file, const char *entry_label, uint64_t budget, int optimize);
+FuzzOutcome fuzz_one(const uint8_t *input, size_t size);
+int fuzz_stdin();
+void fuzz_afl();
+void fuzz_loop(uint64_t runs, uint64_t seed);
+
+#endif // FUZZ_H
\ No newline at end of file
@@ -0,0 +1,674 @@
+/**
+ * Implementation of the gdb stub module.
+ * This module serves the GDB remote serial protocol on a loopback TCP socket. Registers are read and
+ * written through the register module, memory transfers go to the assembled program and guest memory,
+ * and breakpoints and stepping use the debugger module. Label breakpoints and register watchpoints,
+ * which gdb has no packets for, are set with monitor commands. When the program is recorded, gdb can also step and continue
+ * backwards (bs and bc). While the program runs, the socket is only polled for an
+ * interrupt between large budget chunks, so execution runs at full speed until it stops.
+ *
+ * Registers use the MIPS o32 numbering of gdb: 0-31 general purpose, 32 sr, 33 lo, 34 hi, 35 bad,
+ * 36 cause and 37 pc, sent big endian.
+ */
+#include "gdbstub.h"
+#include "assembler.h"
+#include "debugger.h"
+#include "execute.h"
+#include "instruction.h"
+#include "memory.h"
+#include "register.h"
+#include "reverse.h"
+#include "telemetry.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+typedef SOCKET socket_t;
+#define close_socket closesocket
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int socket_t;
+#define close_socket close
+#define INVALID_SOCKET -1
+#endif
+
+#define GDB_PACKET_SIZE 0x4000
+#define GDB_NUM_REGISTERS 38
+#define GDB_CHUNK_SIZE (1 << 20) // Instructions executed between interrupt checks
+
+// Signals reported to gdb.
+#define GDB_SIGINT 2
+#define GDB_SIGTRAP 5
+#define GDB_SIGSEGV 11
+
+static socket_t client = INVALID_SOCKET;
+
+// Receive buffer of the connection.
+static unsigned char receive_buffer[GDB_PACKET_SIZE];
+static int receive_length = 0;
+static int receive_position = 0;
+
+static const char hex_digits[] = "0123456789abcdef";
+
+/**
+ * Read one character from the connection.
+ * @return The character, or -1 if the connection is closed
+ */
+static int get_char()
+{
+    if (receive_position == receive_length)
+    {
+        receive_length = recv(client, (char *)receive_buffer, sizeof(receive_buffer), 0);
+        receive_position = 0;
+        if (receive_length <= 0)
+        {
+            receive_length = 0;
+            return -1;
+        }
+    }
+    return receive_buffer[receive_position++];
+}
+
+static int hex_value(int c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * Read a packet and acknowledge it. The packet data may contain binary data, so its length is returned.
+ * @param packet Buffer for the packet data, GDB_PACKET_SIZE bytes
+ * @return The length of the packet data, or -1 if the connection is closed
+ */
+static int read_packet(char *packet)
+{
+    for (;;)
+    {
+        int c;
+        do
+        {
+            c = get_char();
+            if (c == -1)
+                return -1;
+        } while (c != '$');
+
+        int length = 0;
+        unsigned char checksum = 0;
+        while ((c = get_char()) != '#')
+        {
+            if (c == -1)
+                return -1;
+            if (length < GDB_PACKET_SIZE - 1)
+                packet[length++] = c;
+            checksum += c;
+        }
+        packet[length] = '\0';
+
+        int high = hex_value(get_char());
+        int low = hex_value(get_char());
+        if (high != -1 && low != -1 && ((high << 4) | low) == checksum)
+        {
+            send(client, "+", 1, 0);
+            return length;
+        }
+        send(client, "-", 1, 0);
+    }
+}
+
+/**
+ * Send a packet and wait for the acknowledgement.
+ * @param data The packet data
+ */
+static void write_packet(const char *data)
+{
+    static char packet[GDB_PACKET_SIZE + 4];
+    unsigned char checksum = 0;
+    int length = 0;
+
+    packet[length++] = '$';
+    for (int i = 0; data[i] != '\0' && length < GDB_PACKET_SIZE; i++)
+    {
+        packet[length++] = data[i];
+        checksum += data[i];
+    }
+    packet[length++] = '#';
+    packet[length++] = hex_digits[checksum >> 4];
+    packet[length++] = hex_digits[checksum & 0xF];
+
+    int c;
+    do
+    {
+        send(client, packet, length, 0);
+        c = get_char();
+    } while (c != '+' && c != -1);
+}
+
+/**
+ * Show text on the gdb console with an O packet.
+ * @param text The text to show
+ */
+static void write_console(const char *text)
+{
+    static char packet[GDB_PACKET_SIZE];
+    int length = 0;
+
+    packet[length++] = 'O';
+    for (int i = 0; text[i] != '\0' && length + 2 < GDB_PACKET_SIZE; i++)
+    {
+        packet[length++] = hex_digits[(unsigned char)text[i] >> 4];
+        packet[length++] = hex_digits[text[i] & 0xF];
+    }
+    packet[length] = '\0';
+    write_packet(packet);
+}
+
+/**
+ * Checks if gdb sent an interrupt (Ctrl-C) without blocking.
+ */
+static int interrupt_pending()
+{
+    fd_set set;
+    struct timeval timeout = {0, 0};
+
+    // gdb only sends an interrupt while the program runs.
+    if (receive_position < receive_length)
+        return get_char() == 0x03;
+
+    FD_ZERO(&set);
+    FD_SET(client, &set);
+    if (select(client + 1, &set, NULL, NULL, &timeout) <= 0)
+        return 0;
+
+    return get_char() == 0x03;
+}
+
+static void write_hex32(char *out, uint32_t value)
+{
+    for (int i = 0; i < 8; i++)
+        out[i] = hex_digits[(value >> (28 - i * 4)) & 0xF];
+}
+
+static uint32_t read_hex32(const char *in)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < 8 && hex_value(in[i]) != -1; i++)
+        value = (value << 4) | hex_value(in[i]);
+    return value;
+}
+
+/**
+ * Get a register by its gdb number.
+ */
+static uint32_t get_gdb_register(int number)
+{
+    if (number < REGISTER_TABLE_SIZE)
+        return get_register_value(number);
+
+    switch (number)
+    {
+    case 33:
+        return get_lo();
+    case 34:
+        return get_hi();
+    case 37:
+        return get_pc();
+    }
+    return 0;
+}
+
+/**
+ * Set a register by its gdb number. Writes to $zero, sr, bad and cause are ignored. The caller
+ * drops the recorded history with restart_recording().
+ */
+static void set_gdb_register(int number, uint32_t value)
+{
+    if (number > 0 && number < REGISTER_TABLE_SIZE)
+        set_register_by_index(number, value);
+    else if (number == 33)
+        set_lo(value);
+    else if (number == 34)
+        set_hi(value);
+    else if (number == 37)
+        set_pc((value - INIT_PC) / 4);
+}
+
+/**
+ * Read guest memory. The assembled program is mapped big endian, next to the data segment and the stack.
+ * @return 0 on success, -1 if the range is not mapped
+ */
+static int read_guest_memory(uint32_t address, uint8_t *buffer, uint32_t length)
+{
+    uint8_t *memory = get_memory_pointer(address, length);
+    if (memory != NULL)
+    {
+        memcpy(buffer, memory, length);
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < length; i++)
+    {
+        uint32_t offset = address + i - INIT_PC;
+        if (address + i < INIT_PC || offset >= (uint32_t)instruction_count * 4)
+            return -1;
+        buffer[i] = bytecode[offset / 4] >> (24 - (offset % 4) * 8);
+    }
+    return 0;
+}
+
+/**
+ * Get a word of the assembled program with the bytes of a write applied.
+ */
+static uint32_t get_patched_word(int word, uint32_t address, const uint8_t *buffer, uint32_t length)
+{
+    uint32_t value = bytecode[word];
+    for (int i = 0; i < 4; i++)
+    {
+        uint32_t byte_address = INIT_PC + word * 4 + i;
+        uint32_t shift = 24 - i * 8;
+        if (byte_address - address < length)
+            value = (value & ~(0xFFu << shift)) | ((uint32_t)buffer[byte_address - address] << shift);
+    }
+    return value;
+}
+
+/**
+ * Write guest memory. A modified program is decoded again. The recorded history is dropped, since
+ * executing it again would not repeat the write.
+ * @return 0 on success, -1 if the range is not mapped or a modified word of the program is not an instruction
+ */
+static int write_guest_memory(uint32_t address, const uint8_t *buffer, uint32_t length)
+{
+    uint8_t *memory = get_memory_pointer(address, length);
+    if (memory != NULL)
+    {
+        memcpy(memory, buffer, length);
+        restart_recording();
+        return 0;
+    }
+
+    if (address < INIT_PC || address - INIT_PC + length > (uint32_t)instruction_count * 4)
+        return -1;
+
+    // Decoding a word that is not an instruction would end the emulator, so nothing is written then.
+    int first = (address - INIT_PC) / 4;
+    int end = (address - INIT_PC + length + 3) / 4;
+    for (int word = first; word < end; word++)
+        if (decode_instruction(get_patched_word(word, address, buffer, length)) == -1)
+            return -1;
+
+    for (int word = first; word < end; word++)
+        bytecode[word] = get_patched_word(word, address, buffer, length);
+    if (length > 0)
+    {
+        reload_program();
+        restart_recording();
+    }
+    return 0;
+}
+
+/**
+ * Build the stop reply for the result of a run.
+ */
+static void stop_reply(ExecResult result, char *reply)
+{
+    // The program waits for the debugger now, so bring the published counters up to date.
+    update_telemetry();
+
+    switch (result.status)
+    {
+    case EXEC_HALTED:
+        strcpy(reply, "W00");
+        break;
+    case EXEC_FAULT:
+        sprintf(reply, "S%02x", GDB_SIGSEGV);
+        break;
+    case EXEC_STOPPED:
+        sprintf(reply, "S%02x", GDB_SIGINT);
+        break;
+    case EXEC_WATCHPOINT:
+    {
+        // gdb only knows memory watchpoints, so the change is shown on the console.
+        char text[128];
+        int index, old_value, new_value;
+        if (get_watchpoint_hit(&index, &old_value, &new_value))
+        {
+            sprintf(text, "Watchpoint %s changed from %d to %d\n", REGISTER_NAMES[index], old_value, new_value);
+            write_console(text);
+        }
+        sprintf(reply, "S%02x", GDB_SIGTRAP);
+        break;
+    }
+    default:
+        sprintf(reply, "S%02x", GDB_SIGTRAP);
+        break;
+    }
+}
+
+/**
+ * Continue until the program stops, checking for an interrupt between chunks.
+ */
+static ExecResult continue_execution()
+{
+    ExecResult result = record_run(GDB_CHUNK_SIZE);
+    uint64_t retired = result.retired;
+
+    while (result.status == EXEC_BUDGET_EXHAUSTED)
+    {
+        if (interrupt_pending())
+        {
+            result.status = EXEC_STOPPED;
+            break;
+        }
+        result = record_run(GDB_CHUNK_SIZE);
+        retired += result.retired;
+    }
+
+    result.retired = retired;
+    return result;
+}
+
+/**
+ * Handle a memory read (m addr,length).
+ */
+static void handle_read_memory(const char *packet, char *reply)
+{
+    static uint8_t buffer[GDB_PACKET_SIZE / 2];
+    unsigned long address, length;
+
+    if (sscanf(packet, "%lx,%lx", &address, &length) != 2 || length > sizeof(buffer) - 1 ||
+        read_guest_memory(address, buffer, length) != 0)
+    {
+        strcpy(reply, "E01");
+        return;
+    }
+
+    for (unsigned long i = 0; i < length; i++)
+    {
+        reply[i * 2] = hex_digits[buffer[i] >> 4];
+        reply[i * 2 + 1] = hex_digits[buffer[i] & 0xF];
+    }
+    reply[length * 2] = '\0';
+}
+
+/**
+ * Handle a memory write, hex encoded (M addr,length:data) or binary (X addr,length:data).
+ */
+static void handle_write_memory(const char *packet, int packet_length, int binary, char *reply)
+{
+    static uint8_t buffer[GDB_PACKET_SIZE];
+    unsigned long address, length;
+    const char *data = memchr(packet, ':', packet_length);
+
+    if (data == NULL || sscanf(packet + 1, "%lx,%lx", &address, &length) != 2 || length > sizeof(buffer))
+    {
+        strcpy(reply, "E01");
+        return;
+    }
+    data++;
+
+    const char *end = packet + packet_length;
+    for (unsigned long i = 0; i < length; i++)
+    {
+        if (binary)
+        {
+            // 0x7d escapes the next byte, xored with 0x20.
+            if (data < end && *data == 0x7d)
+                buffer[i] = *++data ^ 0x20;
+            else
+                buffer[i] = *data;
+            data++;
+        }
+        else
+        {
+            buffer[i] = (hex_value(data[0]) << 4) | hex_value(data[1]);
+            data += 2;
+        }
+        if (data > end)
+        {
+            strcpy(reply, "E01");
+            return;
+        }
+    }
+
+    strcpy(reply, write_guest_memory(address, buffer, length) == 0 ? "OK" : "E01");
+}
+
+/**
+ * Handle a breakpoint insert (Z0/Z1) or remove (z0/z1).
+ */
+static void handle_breakpoint(const char *packet, char *reply)
+{
+    unsigned long type, address, kind;
+
+    if (sscanf(packet + 1, "%lx,%lx,%lx", &type, &address, &kind) != 3 || type > 1)
+    {
+        // Only software and hardware breakpoints, which are the same here.
+        reply[0] = '\0';
+        return;
+    }
+
+    int status = packet[0] == 'Z' ? set_breakpoint(address) : remove_breakpoint(address);
+    strcpy(reply, status == 0 || packet[0] == 'z' ? "OK" : "E01");
+}
+
+/**
+ * Handle a monitor command (qRcmd,command), hex encoded. "break label" and "delete label" set and
+ * remove a breakpoint at a label, "watch register" and "unwatch register" a register watchpoint.
+ */
+static void handle_monitor(const char *hex, char *reply)
+{
+    char command[256];
+    char name[256];
+    int length = 0;
+    int status = -1;
+
+    for (; hex[0] != '\0' && hex[1] != '\0' && length < (int)sizeof(command) - 1; hex += 2)
+        command[length++] = (hex_value(hex[0]) << 4) | hex_value(hex[1]);
+    command[length] = '\0';
+
+    if (sscanf(command, "break %255s", name) == 1)
+        status = set_breakpoint_at_label(name);
+    else if (sscanf(command, "delete %255s", name) == 1)
+        status = remove_breakpoint_at_label(name);
+    else if (sscanf(command, "watch %255s", name) == 1)
+        status = add_watchpoint(get_register_index_by_name(name));
+    else if (sscanf(command, "unwatch %255s", name) == 1)
+        status = remove_watchpoint(get_register_index_by_name(name));
+    else
+        write_console("Commands: break label, delete label, watch register, unwatch register\n");
+
+    strcpy(reply, status == 0 ? "OK" : "E01");
+}
+
+/**
+ * Serve one gdb connection until gdb detaches or kills the program.
+ */
+static void serve_client()
+{
+    static char packet[GDB_PACKET_SIZE];
+    static char reply[GDB_PACKET_SIZE];
+    int length;
+
+    while ((length = read_packet(packet)) != -1)
+    {
+        reply[0] = '\0';
+
+        switch (packet[0])
+        {
+        case '?':
+            sprintf(reply, "S%02x", GDB_SIGTRAP);
+            break;
+
+        case 'g':
+            for (int i = 0; i < GDB_NUM_REGISTERS; i++)
+                write_hex32(reply + i * 8, get_gdb_register(i));
+            reply[GDB_NUM_REGISTERS * 8] = '\0';
+            break;
+
+        case 'G':
+            for (int i = 0; i < GDB_NUM_REGISTERS && 1 + (i + 1) * 8 <= length; i++)
+                set_gdb_register(i, read_hex32(packet + 1 + i * 8));
+            restart_recording();
+            strcpy(reply, "OK");
+            break;
+
+        case 'p':
+        {
+            int number = strtol(packet + 1, NULL, 16);
+            if (number < GDB_NUM_REGISTERS)
+            {
+                write_hex32(reply, get_gdb_register(number));
+                reply[8] = '\0';
+            }
+            else
+                strcpy(reply, "E01");
+            break;
+        }
+
+        case 'P':
+        {
+            char *value;
+            int number = strtol(packet + 1, &value, 16);
+            if (*value == '=' && number < GDB_NUM_REGISTERS)
+            {
+                set_gdb_register(number, read_hex32(value + 1));
+                restart_recording();
+                strcpy(reply, "OK");
+            }
+            else
+                strcpy(reply, "E01");
+            break;
+        }
+
+        case 'm':
+            handle_read_memory(packet + 1, reply);
+            break;
+
+        case 'M':
+        case 'X':
+            handle_write_memory(packet, length, packet[0] == 'X', reply);
+            break;
+
+        case 'Z':
+        case 'z':
+            handle_breakpoint(packet, reply);
+            break;
+
+        case 's':
+            stop_reply(record_run(1), reply);
+            break;
+
+        case 'b':
+        {
+            if (packet[1] != 's' && packet[1] != 'c')
+                break;
+
+            ExecResult result = packet[1] == 's' ? reverse_step() : reverse_continue();
+            if (result.status == EXEC_STOPPED)
+                sprintf(reply, "T%02xreplaylog:begin;", GDB_SIGTRAP);
+            else
+                stop_reply(result, reply);
+            break;
+        }
+
+        case 'c':
+            stop_reply(continue_execution(), reply);
+            break;
+
+        case 'H':
+        case 'T':
+            strcpy(reply, "OK");
+            break;
+
+        case 'q':
+            if (strncmp(packet, "qSupported", 10) == 0)
+                sprintf(reply, "PacketSize=%x;ReverseStep+;ReverseContinue+", GDB_PACKET_SIZE);
+            else if (strcmp(packet, "qAttached") == 0)
+                strcpy(reply, "1");
+            else if (strcmp(packet, "qC") == 0)
+                strcpy(reply, "QC1");
+            else if (strcmp(packet, "qfThreadInfo") == 0)
+                strcpy(reply, "m1");
+            else if (strcmp(packet, "qsThreadInfo") == 0)
+                strcpy(reply, "l");
+            else if (strncmp(packet, "qRcmd,", 6) == 0)
+                handle_monitor(packet + 6, reply);
+            break;
+
+        case 'D':
+            write_packet("OK");
+            return;
+
+        case 'k':
+            return;
+        }
+
+        write_packet(reply);
+    }
+}
+
+/**
+ * Serve the gdb remote serial protocol on 127.0.0.1. Returns when gdb detaches or kills the program.
+ * @param port The TCP port to listen on
+ * @return 0 on success, -1 if the socket cannot be set up
+ */
+int gdb_serve(int port)
+{
+#ifdef _WIN32
+    WSADATA wsa_data;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
+        return -1;
+#endif
+
+    socket_t server = socket(AF_INET, SOCK_STREAM, 0);
+    if (server == INVALID_SOCKET)
+    {
+        fprintf(stderr, "Error: Could not create socket.\n");
+        return -1;
+    }
+
+    int reuse = 1;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+
+    if (bind(server, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(server, 1) != 0)
+    {
+        fprintf(stderr, "Error: Could not listen on port %d.\n", port);
+        close_socket(server);
+        return -1;
+    }
+
+    printf("Waiting for gdb on 127.0.0.1:%d\n", port);
+    client = accept(server, NULL, NULL);
+    close_socket(server);
+    if (client == INVALID_SOCKET)
+    {
+        fprintf(stderr, "Error: Could not accept gdb connection.\n");
+        return -1;
+    }
+
+    receive_length = 0;
+    receive_position = 0;
+    serve_client();
+
+    close_socket(client);
+    client = INVALID_SOCKET;
+    return 0;
+}
@@ -0,0 +1,10 @@
+/**
+ * Header file for the gdb stub module.
+ * This module lets gdb debug the guest program over the GDB remote serial protocol.
+ */
+#ifndef GDBSTUB_H
+#define GDBSTUB_H
+
+int gdb_serve(int port);
+
+#endif // GDBSTUB_H
\ No newline at end of file
@@ -0,0 +1,93 @@
+/**
+ * Build-time generator for the instruction tables.
+ * Reads instructions.txt and writes instructions.def, an X-macro list that is compiled
+ * into the emulator so the encodings are known to the compiler.
+ *
+ * Usage: gen_instructions <instructions.txt> <instructions.def>
+ */
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Closes the files after an error and removes the partly written output, so that a later build does
+ * not compile a truncated table.
+ * @return The exit status of the generator
+ */
+static int fail(FILE *input, FILE *output, const char *output_name)
+{
+    fclose(input);
+    fclose(output);
+    remove(output_name);
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "Usage: %s <instructions.txt> <instructions.def>\n", argv[0]);
+        return 1;
+    }
+
+    FILE *input = fopen(argv[1], "r");
+    if (input == NULL)
+    {
+        fprintf(stderr, "Error: Could not open instruction file %s.\n", argv[1]);
+        return 1;
+    }
+
+    FILE *output = fopen(argv[2], "w");
+    if (output == NULL)
+    {
+        fprintf(stderr, "Error: Could not open output file %s.\n", argv[2]);
+        fclose(input);
+        return 1;
+    }
+
+    // Read the number of instructions.
+    int num_instructions = 0;
+    if (fscanf(input, "%d\n", &num_instructions) != 1)
+    {
+        fprintf(stderr, "Error: Missing instruction count in %s.\n", argv[1]);
+        return fail(input, output, argv[2]);
+    }
+
+    fprintf(output, "/* Generated from %s by gen_instructions. Do not edit. */\n", argv[1]);
+    fprintf(output, "/* INSTRUCTION(id, name, type, opcode, funct) */\n");
+
+    // The format of each line is:
+    // <name> <type> <opcode> <funct>
+    for (int i = 0; i < num_instructions; i++)
+    {
+        char name[256];
+        char type;
+        int opcode;
+        int funct;
+        if (fscanf(input, "%255s %c %d %d\n", name, &type, &opcode, &funct) != 4)
+        {
+            fprintf(stderr, "Error: Malformed entry %d in %s.\n", i + 1, argv[1]);
+            return fail(input, output, argv[2]);
+        }
+
+        type = toupper(type);
+        if (type != 'R' && type != 'I' && type != 'J')
+        {
+            fprintf(stderr, "Error: Unknown type %c for instruction %s.\n", type, name);
+            return fail(input, output, argv[2]);
+        }
+
+        // The identifier is the upper case mnemonic.
+        char id[256];
+        for (int j = 0; name[j] != '\0'; j++)
+            id[j] = toupper(name[j]);
+        id[strlen(name)] = '\0';
+
+        fprintf(output, "INSTRUCTION(%s, \"%s\", %c, 0x%02x, 0x%02x)\n", id, name, type, opcode, funct);
+    }
+
+    fclose(input);
+    fclose(output);
+    return 0;
+}
@@ -26,11 +26,25 @@ typedef struct InstructionTable
     int size;
 } InstructionTable;
 
+// Type characters used by the generated table.
+#define TYPE_R 'R'
+#define TYPE_I 'I'
+#define TYPE_J 'J'
+
+// Compiled-in instruction table, generated from instructions.txt.
+static Instruction builtin_instructions[NUM_INSTRUCTIONS] = {
+#define INSTRUCTION(id, name, type, opcode, funct) {name, TYPE_##type, funct, opcode},
+#include "instructions.def"
+#undef INSTRUCTION
+};
+
 // Global variable containing the instruction table.
-InstructionTable instruction_table = {NULL, 0};
+InstructionTable instruction_table = {builtin_instructions, NUM_INSTRUCTIONS};
 
 /**
  * Load the instruction table from a file.
+ * The encodings are compiled in from instructions.txt, so the file is optional. When given, its
+ * entries are checked against the compiled-in table and a stale build is reported.
  * @param filename The name of the file containing the instruction table.
  */
 void load_instruction_table(const char *filename)
@@ -46,17 +60,9 @@ void load_instruction_table(const char *filename)
     int num_instructions = 0;
     fscanf(file, "%d\n", &num_instructions);
 
-    // Allocate memory for the instructions.
-    instruction_table.instructions = (Instruction *)malloc(num_instructions * sizeof(Instruction));
-    if (instruction_table.instructions == NULL)
-    {
-        fprintf(stderr, "Error: Could not allocate memory for instructions.\n");
-        exit(1);
-    }
-
     // Read the instructions.
     // The format of the file is:
-    // <name> <description> <type> <funct> <opcode>
+    // <name> <type> <opcode> <funct>
     for (int i = 0; i < num_instructions; i++)
     {
         char name[256];
@@ -64,20 +70,20 @@ void load_instruction_table(const char *filename)
         int funct;
         int opcode;
         // Reading values from a line.
-        fscanf(file, "%s %c %d %d\n", name, &type, &opcode, &funct);
-        // Store the values in the instruction.
-        instruction_table.instructions[i].name = (char *)malloc(strlen(name) + 1);
-        strcpy(instruction_table.instructions[i].name, name);
-        instruction_table.instructions[i].type = type;
-        instruction_table.instructions[i].funct = funct;
-        instruction_table.instructions[i].opcode = opcode;
+        fscanf(file, "%255s %c %d %d\n", name, &type, &opcode, &funct);
+
+        // Compare the values with the compiled-in instruction.
+        int index = get_instruction_index(name);
+        if (index == -1 ||
+            instruction_table.instructions[index].type != type ||
+            instruction_table.instructions[index].funct != funct ||
+            instruction_table.instructions[index].opcode != opcode)
+            fprintf(stderr, "Warning: Instruction %s in %s differs from the compiled-in table, rebuild the emulator.\n",
+                    name, filename);
     }
 
     // Close the file.
     fclose(file);
-
-    // Set the size of the instruction table.
-    instruction_table.size = num_instructions;
 }
 
 /**
@@ -119,14 +125,17 @@ void add_instruction(char *name, char type, uint8_t funct, uint8_t opcode)
     instruction->funct = funct;
     instruction->opcode = opcode;
 
-    // Add the instruction to the instruction table.
-    instruction_table.instructions = (Instruction *)realloc(instruction_table.instructions,
-                                             (instruction_table.size + 1) * sizeof(Instruction));
-    if (instruction_table.instructions == NULL)
+    // Add the instruction to the instruction table. The compiled-in table is copied on first use.
+    Instruction *instructions = (Instruction *)malloc((instruction_table.size + 1) * sizeof(Instruction));
+    if (instructions == NULL)
     {
         fprintf(stderr, "Error: Could not allocate memory for instructions.\n");
         exit(1);
     }
+    memcpy(instructions, instruction_table.instructions, instruction_table.size * sizeof(Instruction));
+    if (instruction_table.instructions != builtin_instructions)
+        free(instruction_table.instructions);
+    instruction_table.instructions = instructions;
     instruction_table.instructions[instruction_table.size] = *instruction;
     instruction_table.size++;
 }
@@ -149,7 +158,7 @@ void store_instruction_table(char *filename)
 
     // Write the instructions.
     // The format of the file is:
-    // <name> <description> <type> <funct> <opcode>
+    // <name> <type> <opcode> <funct>
     for (int i = 0; i < instruction_table.size; i++)
         fprintf(file, "%s %c %d %d\n",
                 instruction_table.instructions[i].name,
@@ -195,4 +204,72 @@ int get_instruction_index(char *name)
             return i;
 
     return -1;
+}
+
+const char *get_instruction_name(int index)
+{
+    if (index < 0 || index >= instruction_table.size)
+        return NULL;
+
+    return instruction_table.instructions[index].name;
+}
+
+// Encoding of each instruction type, opcode in the top six bits and funct in the low six bits.
+#define ENCODE_R(opcode, funct) (((uint32_t)(opcode) << 26) | (funct))
+#define ENCODE_I(opcode, funct) ((uint32_t)(opcode) << 26)
+#define ENCODE_J(opcode, funct) ((uint32_t)(opcode) << 26)
+
+/**
+ * Get the opcode and funct bits of an instruction.
+ * @param id The identifier of the instruction.
+ * @return The bytecode with only the opcode and funct fields set.
+ */
+uint32_t encode_instruction(InstructionId id)
+{
+    switch (id)
+    {
+#define INSTRUCTION(id, name, type, opcode, funct) \
+    case INSTR_##id:                              \
+        return ENCODE_##type(opcode, funct);
+#include "instructions.def"
+#undef INSTRUCTION
+    default:
+        return 0;
+    }
+}
+
+// Only R-type instructions are selected by funct, the others by opcode.
+#define DECODE_FUNCT_R(id, opcode, funct) \
+    case funct:                           \
+        return INSTR_##id;
+#define DECODE_FUNCT_I(id, opcode, funct)
+#define DECODE_FUNCT_J(id, opcode, funct)
+#define DECODE_OPCODE_R(id, opcode, funct)
+#define DECODE_OPCODE_I(id, opcode, funct) \
+    case opcode:                           \
+        return INSTR_##id;
+#define DECODE_OPCODE_J(id, opcode, funct) DECODE_OPCODE_I(id, opcode, funct)
+
+/**
+ * Find the instruction encoded in a bytecode.
+ * @param bytecode The bytecode to decode.
+ * @return The identifier of the instruction, or -1 if the encoding is unknown.
+ */
+int decode_instruction(uint32_t bytecode)
+{
+    switch (bytecode >> 26)
+    {
+    case 0x00:
+        switch (bytecode & 0x3F)
+        {
+#define INSTRUCTION(id, name, type, opcode, funct) DECODE_FUNCT_##type(id, opcode, funct)
+#include "instructions.def"
+#undef INSTRUCTION
+        }
+        break;
+#define INSTRUCTION(id, name, type, opcode, funct) DECODE_OPCODE_##type(id, opcode, funct)
+#include "instructions.def"
+#undef INSTRUCTION
+    }
+    return -1;
 }
\ No newline at end of file
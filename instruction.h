@@ -2,6 +2,7 @@
  * Header file for opcode table module
  * This module contains the opcode table, which is used to
  * translate opcodes into function calls.
+ * The table is generated from instructions.txt at build time (see gen_instructions.c).
  */
 #ifndef INSTRUCTION_H
 #define INSTRUCTION_H
@@ -11,6 +12,15 @@
 typedef struct instruction_t Instruction;
 typedef struct InstructionTable InstructionTable;
 
+// Instruction identifiers, one per entry of instructions.txt.
+typedef enum instruction_id
+{
+#define INSTRUCTION(id, name, type, opcode, funct) INSTR_##id,
+#include "instructions.def"
+#undef INSTRUCTION
+    NUM_INSTRUCTIONS
+} InstructionId;
+
 extern InstructionTable instruction_table;
 
 void print_instruction_table();
@@ -21,5 +31,10 @@ char get_instruction_type_by_name(char *name);
 uint8_t get_instruction_funct_by_name(char *name);
 uint8_t get_instruction_opcode_by_name(char *name);
 int get_instruction_index(char *name);
+const char *get_instruction_name(int index);
+
+// Generated encoder and decoder.
+uint32_t encode_instruction(InstructionId id);
+int decode_instruction(uint32_t bytecode);
 
 #endif // INSTRUCTION_H
\ No newline at end of file
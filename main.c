@@ -1,27 +1,164 @@
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "assembler.h"
+#include "debugger.h"
+#include "emulator.h"
+#include "fuzz.h"
+#include "gdbstub.h"
+#include "profiler.h"
+#include "register.h"
+#include "reverse.h"
+#include "telemetry.h"
+
+// Bounds every run so that runaway loops in the guest terminate.
+#define DEFAULT_BUDGET 1000000
+
+// Labels given with -b and registers given with -w.
+static char *break_labels[MAX_BREAKPOINTS];
+static int break_count = 0;
+static char *watch_registers[MAX_BREAKPOINTS];
+static int watch_count = 0;
 
 void usage();
-void test_assembler();
+void handle_interrupt(int signal);
+void test_emulator(const char *asm_file, int optimize);
 
 int main(int argc, char **argv)
 {
-    test_assembler();
+    const char *asm_file = "simple_add.asm";
+    int gdb_port = 0;
+    long long record_interval = 0;
+    int profile = 0;
+    int publish = 0;
+    int optimize = 1;
+    const char *fuzz_label = NULL;
+    long long fuzz_runs = DEFAULT_FUZZ_RUNS;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+            asm_file = argv[++i];
+        else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc)
+            gdb_port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+            record_interval = atoll(argv[++i]);
+        else if (strcmp(argv[i], "-p") == 0)
+            profile = 1;
+        else if (strcmp(argv[i], "-t") == 0)
+            publish = 1;
+        else if (strcmp(argv[i], "-l") == 0)
+            set_lazy_assembly(1);
+        else if (strcmp(argv[i], "-O0") == 0)
+            optimize = 0;
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc && break_count < MAX_BREAKPOINTS)
+            break_labels[break_count++] = argv[++i];
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc && watch_count < MAX_BREAKPOINTS)
+            watch_registers[watch_count++] = argv[++i];
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+            fuzz_label = argv[++i];
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            fuzz_runs = atoll(argv[++i]);
+        else
+        {
+            usage();
+            return (1);
+        }
+    }
+
+    if (publish && start_telemetry() != 0)
+        return (1);
+
+    if (fuzz_label != NULL)
+    {
+        if (init_fuzzer(asm_file, fuzz_label, DEFAULT_FUZZ_BUDGET, optimize) != 0)
+            return (1);
+
+        if (getenv("__AFL_SHM_ID") != NULL)
+            fuzz_afl();
+        else
+            fuzz_loop(fuzz_runs, (uint64_t)time(NULL));
+        stop_telemetry();
+        return (0);
+    }
+
+    if (gdb_port != 0)
+    {
+        // Debug the program as written, without the optimizer.
+        init_emulator(asm_file, 0);
+        if (record_interval > 0 && start_recording(record_interval, DEFAULT_CHECKPOINT_COUNT) != 0)
+            return (1);
+        int status = gdb_serve(gdb_port) == 0 ? 0 : 1;
+        stop_telemetry();
+        return status;
+    }
+
+    // Without counters the program still runs, just without the profile.
+    if (profile)
+        profile = start_profiling(DEFAULT_SAMPLE_PERIOD) == 0;
+
+    // Ctrl-C stops the guest and still prints its registers.
+    signal(SIGINT, handle_interrupt);
+    test_emulator(asm_file, optimize);
+
+    if (profile)
+    {
+        stop_profiling();
+        print_profile();
+    }
+    stop_telemetry();
     return (0);
 }
 
 void usage()
 {
-    printf("./emulator -i filename.asm\n");
+    printf("./emulator -i filename.asm [-l] [-O0] [-p] [-t] [-b label]... [-w register]... [-g port [-r checkpoint_interval]] [-f label [-n runs]]\n");
 }
 
-void test_assembler()
+void handle_interrupt(int signal)
 {
-    const char *asm_file = "simple_add.asm";
-    const char *instructions_data = "instructions.txt";
+    (void)signal;
+    request_stop();
+}
+
+void test_emulator(const char *asm_file, int optimize)
+{
+    const char *status_names[] = {"halted", "fault", "budget exhausted", "stopped", "breakpoint", "watchpoint"};
+
+    init_emulator(asm_file, optimize);
+
+    for (int i = 0; i < break_count; i++)
+        if (set_breakpoint_at_label(break_labels[i]) != 0)
+            exit(1);
+    for (int i = 0; i < watch_count; i++)
+        if (add_watchpoint(get_register_index_by_name(watch_registers[i])) != 0)
+            exit(1);
 
-    init_assembler(instructions_data, asm_file);
+    // Report every breakpoint and watchpoint hit and carry on with the rest of the budget.
+    uint64_t retired = 0;
+    ExecResult result = run_emulator(DEFAULT_BUDGET);
+    retired += result.retired;
+    for (;;)
+    {
+        // A watched register written by the last instruction is reported even if the program halted.
+        int index, old_value, new_value;
+        if (get_watchpoint_hit(&index, &old_value, &new_value))
+            printf("Watchpoint %s changed from %d to %d before 0x%08x\n",
+                   REGISTER_NAMES[index], old_value, new_value, result.pc);
+        if (result.status == EXEC_BREAKPOINT)
+            printf("Breakpoint at 0x%08x after %llu instructions\n", result.pc, (unsigned long long)retired);
+        else if (result.status != EXEC_WATCHPOINT)
+            break;
+        result = run_emulator(DEFAULT_BUDGET - retired);
+        retired += result.retired;
+    }
 
-    assemble();
+    printf("\nExecution %s after %llu instructions at 0x%08x\n",
+           status_names[result.status], (unsigned long long)retired, result.pc);
+    if (get_lazy_assembly())
+        printf("Lazy assembly encoded %d of %d instructions.\n", get_encoded_count(), instruction_count);
+    print_register_table();
 }
\ No newline at end of file
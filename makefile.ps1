@@ -1,2 +1,5 @@
-gcc main.c register.c instruction.c assembler.c execute.c emulator.c -Wall -o test.exe 
+gcc gen_instructions.c -Wall -o gen_instructions.exe
+./gen_instructions.exe instructions.txt instructions.def
+gcc main.c register.c instruction.c assembler.c execute.c optimizer.c debugger.c gdbstub.c reverse.c memory.c profiler.c telemetry.c fuzz.c emulator.c -Wall -lws2_32 -o test.exe
+gcc telemetry_reader.c -Wall -o telemetry_reader.exe
 ./test.exe
\ No newline at end of file
@@ -0,0 +1,134 @@
+/**
+ * Implementation of the memory module.
+ * The data segment is not copied: the buffer the assembler laid the data out in becomes guest memory,
+ * so even large initialized tables are mapped without touching every word. The stack is allocated
+ * once and cleared on every initialization.
+ */
+#include "memory.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint8_t *data_memory = NULL;
+static uint32_t data_memory_size = 0;
+static uint8_t *stack_memory = NULL;
+
+/**
+ * Initializes guest memory.
+ * @param data The data segment, holding size rounded up to a multiple of MEMORY_PAGE_SIZE bytes.
+ *             It is used in place and must stay valid while the program runs.
+ * @param size The size of the data segment
+ */
+void init_memory(uint8_t *data, uint32_t size)
+{
+    if (stack_memory == NULL)
+    {
+        stack_memory = (uint8_t *)malloc(STACK_SIZE);
+        if (stack_memory == NULL)
+        {
+            printf("Error: Could not allocate the stack.\n");
+            exit(1);
+        }
+    }
+    memset(stack_memory, 0, STACK_SIZE);
+
+    data_memory = data;
+    data_memory_size = (size + MEMORY_PAGE_SIZE - 1) & ~(uint32_t)(MEMORY_PAGE_SIZE - 1);
+}
+
+/**
+ * Get the host address of a range of guest memory.
+ * @param address The guest address of the range
+ * @param length The length of the range
+ * @return The host address, or NULL if the range is not mapped as a whole
+ */
+uint8_t *get_memory_pointer(uint32_t address, uint32_t length)
+{
+    if (address >= DATA_SEGMENT_START && address - DATA_SEGMENT_START < data_memory_size &&
+        length <= data_memory_size - (address - DATA_SEGMENT_START))
+        return data_memory + (address - DATA_SEGMENT_START);
+
+    if (address >= STACK_END - STACK_SIZE && address < STACK_END && length <= STACK_END - address)
+        return stack_memory + (address - (STACK_END - STACK_SIZE));
+
+    return NULL;
+}
+
+/**
+ * Get the number of the page containing an address. The data segment pages come first, then the
+ * stack pages.
+ * @param address The guest address
+ * @return The page number, or -1 if the address is not mapped
+ */
+int get_memory_page(uint32_t address)
+{
+    if (address >= DATA_SEGMENT_START && address - DATA_SEGMENT_START < data_memory_size)
+        return (address - DATA_SEGMENT_START) / MEMORY_PAGE_SIZE;
+
+    if (address >= STACK_END - STACK_SIZE && address < STACK_END)
+        return (data_memory_size + address - (STACK_END - STACK_SIZE)) / MEMORY_PAGE_SIZE;
+
+    return -1;
+}
+
+/**
+ * Get the number of mapped pages.
+ */
+int get_memory_page_count()
+{
+    return (data_memory_size + STACK_SIZE) / MEMORY_PAGE_SIZE;
+}
+
+/**
+ * Get the guest address of a page.
+ * @param page The page number, see get_memory_page()
+ */
+uint32_t get_memory_page_address(int page)
+{
+    uint32_t offset = (uint32_t)page * MEMORY_PAGE_SIZE;
+    if (offset < data_memory_size)
+        return DATA_SEGMENT_START + offset;
+    return STACK_END - STACK_SIZE + (offset - data_memory_size);
+}
+
+/**
+ * Load a value from guest memory.
+ * @param address The address, aligned to the size
+ * @param size The size of the value in bytes, 1, 2 or 4
+ * @param value The loaded value, zero extended
+ * @return 0 on success, -1 if the address is unaligned or not mapped
+ */
+int load_memory(uint32_t address, int size, uint32_t *value)
+{
+    uint8_t *bytes = get_memory_pointer(address, size);
+    if (bytes == NULL || address % size != 0)
+        return -1;
+
+    uint32_t result = 0;
+    for (int i = 0; i < size; i++)
+        result = (result << 8) | bytes[i];
+    *value = result;
+    return 0;
+}
+
+/**
+ * Store a value to guest memory.
+ * @param address The address, aligned to the size
+ * @param size The size of the value in bytes, 1, 2 or 4
+ * @param value The value, only the low size bytes are stored
+ * @return 0 on success, -1 if the address is unaligned or not mapped
+ */
+int store_memory(uint32_t address, int size, uint32_t value)
+{
+    uint8_t *bytes = get_memory_pointer(address, size);
+    if (bytes == NULL || address % size != 0)
+        return -1;
+
+    for (int i = size - 1; i >= 0; i--)
+    {
+        bytes[i] = value & 0xFF;
+        value >>= 8;
+    }
+    return 0;
+}
\ No newline at end of file
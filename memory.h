@@ -0,0 +1,26 @@
+/**
+ * Header file for the memory module.
+ * Guest memory consists of the data segment laid out by the assembler and a stack below 0x80000000.
+ * Memory is big endian, like the bytecode.
+ */
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <stdint.h>
+
+#define DATA_SEGMENT_START 0x10010000    // Address of the data segment
+#define MAX_DATA_SEGMENT_SIZE 0x10000000 // Maximum size of the data segment
+#define STACK_END 0x80000000             // Address after the stack
+#define STACK_SIZE 0x00100000            // Size of the stack
+#define INIT_SP (STACK_END - 4)          // Initial stack pointer
+#define MEMORY_PAGE_SIZE 4096
+
+void init_memory(uint8_t *data, uint32_t size);
+uint8_t *get_memory_pointer(uint32_t address, uint32_t length);
+int get_memory_page(uint32_t address);
+int get_memory_page_count();
+uint32_t get_memory_page_address(int page);
+int load_memory(uint32_t address, int size, uint32_t *value);
+int store_memory(uint32_t address, int size, uint32_t value);
+
+#endif // MEMORY_H
\ No newline at end of file
@@ -0,0 +1,643 @@
+/**
+ * Implementation of the optimizer module.
+ * This module rewrites the internal code stream before execution. It builds a control flow graph
+ * over the decoded bytecode and runs constant propagation, branch folding and dead code elimination.
+ * Removed instructions are compacted away while every remaining instruction keeps its original index,
+ * so the pc reported by the executor is always an address of the assembled program.
+ */
+#include "optimizer.h"
+#include "execute.h"
+#include "assembler.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define NUM_REGISTERS 32
+#define ALL_REGISTERS 0xFFFFFFFFu
+
+// Lattice values of the constant propagation.
+#define CONST_UNDEF 0   // Not reached yet
+#define CONST_KNOWN 1   // Always the same value
+#define CONST_VARYING 2 // Unknown at assembly time
+
+typedef struct const_state
+{
+    uint8_t kind[NUM_REGISTERS];
+    int32_t value[NUM_REGISTERS];
+} ConstState;
+
+// Control flow graph over exec_code.
+static int block_start[MAX_NUM_INSTRUCTIONS + 1];
+static int block_of[MAX_NUM_INSTRUCTIONS + 1];
+static int num_blocks;
+
+static ConstState block_in[MAX_NUM_INSTRUCTIONS];
+static uint32_t live_in[MAX_NUM_INSTRUCTIONS];
+static uint8_t reachable[MAX_NUM_INSTRUCTIONS];
+
+// Instructions of bytecode[] labels point at.
+static uint8_t labelled[MAX_NUM_INSTRUCTIONS];
+
+static int is_branch(const ExecInstruction *instruction)
+{
+    return instruction->op == INSTR_BEQ || instruction->op == INSTR_BNE ||
+           instruction->op == INSTR_BLEZ || instruction->op == INSTR_BGTZ;
+}
+
+static int is_jump(const ExecInstruction *instruction)
+{
+    return instruction->op == INSTR_J || instruction->op == INSTR_JAL ||
+           instruction->op == INSTR_JR || instruction->op == INSTR_JALR;
+}
+
+/**
+ * Checks if execution can enter an instruction without a visible direct branch.
+ * This is the program entry, any labelled instruction and the return site of a call.
+ */
+static int is_root(int index)
+{
+    if (index == 0 || labelled[exec_code[index].original_index])
+        return 1;
+
+    return index > 0 && (exec_code[index - 1].op == INSTR_JAL || exec_code[index - 1].op == INSTR_JALR);
+}
+
+/**
+ * Splits exec_code into basic blocks.
+ */
+static void build_blocks()
+{
+    static uint8_t leader[MAX_NUM_INSTRUCTIONS + 1];
+    memset(leader, 0, sizeof(leader));
+    memset(labelled, 0, sizeof(labelled));
+    mark_label_targets(labelled);
+
+    for (int i = 0; i < exec_count; i++)
+    {
+        if (is_root(i))
+            leader[i] = 1;
+        if (is_branch(&exec_code[i]) || is_jump(&exec_code[i]))
+        {
+            leader[i + 1] = 1;
+            if (exec_code[i].target >= 0 && exec_code[i].target < exec_count)
+                leader[exec_code[i].target] = 1;
+        }
+    }
+
+    num_blocks = 0;
+    for (int i = 0; i < exec_count; i++)
+    {
+        if (leader[i] || i == 0)
+            block_start[num_blocks++] = i;
+        block_of[i] = num_blocks - 1;
+    }
+    block_start[num_blocks] = exec_count;
+    block_of[exec_count] = num_blocks;
+}
+
+/**
+ * Get the successor blocks of a block. Indirect jumps and leaving the program have no successors.
+ * @return The number of successors
+ */
+static int get_successors(int block, int successors[2])
+{
+    const ExecInstruction *last = &exec_code[block_start[block + 1] - 1];
+    int count = 0;
+
+    if (is_branch(last) || last->op == INSTR_J || last->op == INSTR_JAL)
+        if (last->target >= 0 && last->target < exec_count)
+            successors[count++] = block_of[last->target];
+
+    if (!is_jump(last) && block + 1 < num_blocks)
+        successors[count++] = block + 1;
+
+    return count;
+}
+
+/**
+ * Checks if control can leave the block to code the graph does not see.
+ */
+static int block_exits(int block)
+{
+    const ExecInstruction *last = &exec_code[block_start[block + 1] - 1];
+
+    if (last->op == INSTR_JR || last->op == INSTR_JALR || last->op == INSTR_JAL)
+        return 1;
+    if ((is_branch(last) || last->op == INSTR_J) && (last->target < 0 || last->target >= exec_count))
+        return 1;
+
+    return !is_jump(last) && block + 1 == num_blocks;
+}
+
+/**
+ * Evaluates an instruction which only writes rd from its operands.
+ * @return 1 if the instruction is such an instruction, 0 otherwise
+ */
+static int evaluate(const ExecInstruction *instruction, int32_t rs, int32_t rt, int32_t *value)
+{
+    switch (instruction->op)
+    {
+    case INSTR_ADD:
+        *value = (int32_t)((uint32_t)rs + (uint32_t)rt);
+        return 1;
+    case INSTR_SUB:
+        *value = (int32_t)((uint32_t)rs - (uint32_t)rt);
+        return 1;
+    case INSTR_AND:
+        *value = rs & rt;
+        return 1;
+    case INSTR_OR:
+        *value = rs | rt;
+        return 1;
+    case INSTR_XOR:
+        *value = rs ^ rt;
+        return 1;
+    case INSTR_NOR:
+        *value = ~(rs | rt);
+        return 1;
+    case INSTR_ADDI:
+        *value = (int32_t)((uint32_t)rs + (uint32_t)instruction->imm);
+        return 1;
+    case INSTR_SUBI:
+        *value = (int32_t)((uint32_t)rs - (uint32_t)instruction->imm);
+        return 1;
+    case INSTR_ANDI:
+        *value = rs & instruction->imm;
+        return 1;
+    case INSTR_ORI:
+        *value = rs | instruction->imm;
+        return 1;
+    case INSTR_SLL:
+        *value = (int32_t)((uint32_t)rt << instruction->imm);
+        return 1;
+    case INSTR_SRL:
+        *value = (int32_t)((uint32_t)rt >> instruction->imm);
+        return 1;
+    case INSTR_SRA:
+        *value = rt >> instruction->imm;
+        return 1;
+    case INSTR_SLT:
+        *value = rs < rt;
+        return 1;
+    case INSTR_LUI:
+    case OP_LI:
+        *value = instruction->imm;
+        return 1;
+    case OP_MOVE:
+        *value = rs;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Get the registers read by an instruction as a bit mask.
+ * Loads and stores may fault, and the state at a fault must match the unoptimized program, so they
+ * count as reading every register.
+ */
+static uint32_t get_uses(const ExecInstruction *instruction)
+{
+    switch (instruction->op)
+    {
+    case INSTR_LB:
+    case INSTR_LBU:
+    case INSTR_LH:
+    case INSTR_LHU:
+    case INSTR_LW:
+    case INSTR_SB:
+    case INSTR_SH:
+    case INSTR_SW:
+        return ALL_REGISTERS;
+    case INSTR_SLL:
+    case INSTR_SRL:
+    case INSTR_SRA:
+        return 1u << instruction->rt;
+    case INSTR_ADDI:
+    case INSTR_SUBI:
+    case INSTR_ANDI:
+    case INSTR_ORI:
+    case INSTR_BLEZ:
+    case INSTR_BGTZ:
+    case INSTR_JR:
+    case INSTR_JALR:
+    case OP_MOVE:
+        return 1u << instruction->rs;
+    case INSTR_J:
+    case INSTR_JAL:
+    case INSTR_LUI:
+    case INSTR_MFHI:
+    case INSTR_MFLO:
+    case OP_LI:
+    case OP_NOP:
+        return 0;
+    default:
+        return (1u << instruction->rs) | (1u << instruction->rt);
+    }
+}
+
+/**
+ * Get the register written by an instruction, or 0 if it writes none.
+ * Loads write a register but are never removed, since they may fault.
+ */
+static int get_def(const ExecInstruction *instruction)
+{
+    int32_t value;
+    switch (instruction->op)
+    {
+    case INSTR_JAL:
+    case INSTR_JALR:
+    case INSTR_MFHI:
+    case INSTR_MFLO:
+    case INSTR_LB:
+    case INSTR_LBU:
+    case INSTR_LH:
+    case INSTR_LHU:
+    case INSTR_LW:
+        return instruction->rd;
+    }
+    if (evaluate(instruction, 0, 0, &value))
+        return instruction->rd;
+    return 0;
+}
+
+/**
+ * Applies an instruction to the constant state.
+ */
+static void transfer(const ExecInstruction *instruction, ConstState *state)
+{
+    int rd = get_def(instruction);
+    if (rd == 0)
+        return;
+
+    int32_t value;
+    uint32_t uses = get_uses(instruction);
+    int known = evaluate(instruction, state->value[instruction->rs], state->value[instruction->rt], &value);
+    for (int r = 0; r < NUM_REGISTERS; r++)
+        if ((uses & (1u << r)) && state->kind[r] != CONST_KNOWN)
+            known = 0;
+
+    state->kind[rd] = known ? CONST_KNOWN : CONST_VARYING;
+    state->value[rd] = known ? value : 0;
+}
+
+/**
+ * Merges the state flowing out of a block into the state at the start of a successor.
+ * @return 1 if the successor state changed
+ */
+static int meet(ConstState *into, const ConstState *from)
+{
+    int changed = 0;
+    for (int r = 0; r < NUM_REGISTERS; r++)
+    {
+        uint8_t kind = into->kind[r];
+        if (from->kind[r] == CONST_UNDEF)
+            continue;
+        if (kind == CONST_UNDEF)
+        {
+            into->kind[r] = from->kind[r];
+            into->value[r] = from->value[r];
+            changed = 1;
+        }
+        else if (kind == CONST_KNOWN && (from->kind[r] == CONST_VARYING || from->value[r] != into->value[r]))
+        {
+            into->kind[r] = CONST_VARYING;
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+/**
+ * Forward constant propagation over the blocks until the states no longer change.
+ */
+static void propagate_constants()
+{
+    memset(block_in, 0, num_blocks * sizeof(ConstState));
+
+    // Anything may hold at blocks entered from outside the graph, except $zero.
+    for (int b = 0; b < num_blocks; b++)
+        if (is_root(block_start[b]))
+            for (int r = 0; r < NUM_REGISTERS; r++)
+                block_in[b].kind[r] = r == 0 ? CONST_KNOWN : CONST_VARYING;
+
+    int changed = 1;
+    while (changed)
+    {
+        changed = 0;
+        for (int b = 0; b < num_blocks; b++)
+        {
+            if (block_in[b].kind[0] == CONST_UNDEF)
+                continue;
+
+            ConstState state = block_in[b];
+            for (int i = block_start[b]; i < block_start[b + 1]; i++)
+                transfer(&exec_code[i], &state);
+
+            int successors[2];
+            int count = get_successors(b, successors);
+            for (int s = 0; s < count; s++)
+                changed |= meet(&block_in[successors[s]], &state);
+        }
+    }
+}
+
+/**
+ * Decides a branch from the constant state.
+ * @return 1 if always taken, 0 if never taken, -1 if unknown
+ */
+static int fold_branch(const ExecInstruction *instruction, const ConstState *state)
+{
+    // Comparing a register with itself does not need its value.
+    if (instruction->rs == instruction->rt && (instruction->op == INSTR_BEQ || instruction->op == INSTR_BNE))
+        return instruction->op == INSTR_BEQ;
+
+    int rs_known = state->kind[instruction->rs] == CONST_KNOWN;
+    int rt_known = state->kind[instruction->rt] == CONST_KNOWN;
+    int32_t rs = state->value[instruction->rs];
+    int32_t rt = state->value[instruction->rt];
+
+    switch (instruction->op)
+    {
+    case INSTR_BEQ:
+        return rs_known && rt_known ? rs == rt : -1;
+    case INSTR_BNE:
+        return rs_known && rt_known ? rs != rt : -1;
+    case INSTR_BLEZ:
+        return rs_known ? rs <= 0 : -1;
+    case INSTR_BGTZ:
+        return rs_known ? rs > 0 : -1;
+    }
+    return -1;
+}
+
+/**
+ * Rewrites instructions using the constants known at each point.
+ * Constant results become li, copies and shifts by zero become move, and decided branches become
+ * either a jump or a nop.
+ */
+static void rewrite_constants()
+{
+    for (int b = 0; b < num_blocks; b++)
+    {
+        if (block_in[b].kind[0] == CONST_UNDEF)
+            continue;
+
+        ConstState state = block_in[b];
+        for (int i = block_start[b]; i < block_start[b + 1]; i++)
+        {
+            ExecInstruction *instruction = &exec_code[i];
+            int32_t value;
+
+            if (is_branch(instruction))
+            {
+                int taken = fold_branch(instruction, &state);
+                if (taken == 1)
+                    instruction->op = INSTR_J;
+                else if (taken == 0)
+                    instruction->op = OP_NOP;
+            }
+            else if (evaluate(instruction, 0, 0, &value))
+            {
+                ExecInstruction before = *instruction;
+                if (instruction->rd == 0)
+                    instruction->op = OP_NOP;
+                else
+                {
+                    uint32_t uses = get_uses(instruction);
+                    int known = 1;
+                    for (int r = 0; r < NUM_REGISTERS; r++)
+                        if ((uses & (1u << r)) && state.kind[r] != CONST_KNOWN)
+                            known = 0;
+
+                    int source = (uses == 1u << instruction->rt) ? instruction->rt : instruction->rs;
+                    int is_copy = ((instruction->op == INSTR_ADD || instruction->op == INSTR_OR ||
+                                    instruction->op == INSTR_XOR) &&
+                                   instruction->rt == 0) ||
+                                  ((instruction->op == INSTR_ADDI || instruction->op == INSTR_SUBI ||
+                                    instruction->op == INSTR_ORI || instruction->op == INSTR_SLL ||
+                                    instruction->op == INSTR_SRL || instruction->op == INSTR_SRA) &&
+                                   instruction->imm == 0);
+
+                    if (known)
+                    {
+                        evaluate(instruction, state.value[instruction->rs], state.value[instruction->rt], &value);
+                        instruction->op = OP_LI;
+                        instruction->imm = value;
+                    }
+                    else if (is_copy && source == instruction->rd)
+                        instruction->op = OP_NOP;
+                    else if (is_copy)
+                    {
+                        instruction->op = OP_MOVE;
+                        instruction->rs = source;
+                    }
+                }
+                transfer(&before, &state);
+                continue;
+            }
+            transfer(instruction, &state);
+        }
+    }
+}
+
+/**
+ * Marks the blocks reachable from the roots.
+ */
+static void find_reachable()
+{
+    static int worklist[MAX_NUM_INSTRUCTIONS];
+    int count = 0;
+
+    memset(reachable, 0, num_blocks);
+    for (int b = 0; b < num_blocks; b++)
+        if (is_root(block_start[b]))
+        {
+            reachable[b] = 1;
+            worklist[count++] = b;
+        }
+
+    while (count > 0)
+    {
+        int successors[2];
+        int b = worklist[--count];
+        int num_successors = get_successors(b, successors);
+        for (int s = 0; s < num_successors; s++)
+            if (!reachable[successors[s]])
+            {
+                reachable[successors[s]] = 1;
+                worklist[count++] = successors[s];
+            }
+    }
+}
+
+/**
+ * Get the registers live at the end of a block.
+ */
+static uint32_t get_live_out(int block)
+{
+    int successors[2];
+    int count = get_successors(block, successors);
+    uint32_t live = block_exits(block) ? ALL_REGISTERS : 0;
+    for (int s = 0; s < count; s++)
+        live |= live_in[successors[s]];
+    return live;
+}
+
+/**
+ * Removes unreachable blocks and register writes that are never read.
+ * All registers are live wherever control leaves the graph.
+ */
+static void eliminate_dead_code()
+{
+    for (int b = 0; b < num_blocks; b++)
+        if (!reachable[b])
+            for (int i = block_start[b]; i < block_start[b + 1]; i++)
+            {
+                // Never executed, so not charged either.
+                exec_code[i].op = OP_NOP;
+                exec_code[i].weight = 0;
+            }
+
+    // Backward liveness until the block states no longer change.
+    memset(live_in, 0, num_blocks * sizeof(uint32_t));
+    int changed = 1;
+    while (changed)
+    {
+        changed = 0;
+        for (int b = num_blocks - 1; b >= 0; b--)
+        {
+            uint32_t live = get_live_out(b);
+            for (int i = block_start[b + 1] - 1; i >= block_start[b]; i--)
+                live = (live & ~(1u << get_def(&exec_code[i]))) | get_uses(&exec_code[i]);
+
+            if (live != live_in[b])
+            {
+                live_in[b] = live;
+                changed = 1;
+            }
+        }
+    }
+
+    // Drop pure instructions whose result is overwritten before it is read.
+    for (int b = 0; b < num_blocks; b++)
+    {
+        uint32_t live = get_live_out(b);
+        for (int i = block_start[b + 1] - 1; i >= block_start[b]; i--)
+        {
+            ExecInstruction *instruction = &exec_code[i];
+            int32_t value;
+            int rd = get_def(instruction);
+
+            if (evaluate(instruction, 0, 0, &value) && !(live & (1u << rd)))
+            {
+                instruction->op = OP_NOP;
+                continue;
+            }
+            live = (live & ~(1u << rd)) | get_uses(instruction);
+        }
+    }
+}
+
+/**
+ * Moves the weight of the nops to the instructions that are kept, so that the executor still charges
+ * every program instruction. The weight of a nop goes to the next kept instruction of its block. Where
+ * a block starts before that instruction, control may enter without passing the nops, so the last of
+ * them stays as a nop carrying the weight. The same happens when a weight would overflow. Either way an
+ * instruction stands for itself and the weight - 1 instructions before it.
+ */
+static void merge_weights()
+{
+    int pending = 0;
+    int last_nop = -1;
+    for (int i = 0; i < exec_count; i++)
+    {
+        ExecInstruction *instruction = &exec_code[i];
+        if (pending > 0 && (block_start[block_of[i]] == i || pending + instruction->weight > UINT8_MAX))
+        {
+            exec_code[last_nop].weight = pending;
+            pending = 0;
+        }
+
+        if (instruction->op == OP_NOP)
+        {
+            if (instruction->weight > 0)
+            {
+                pending += instruction->weight;
+                instruction->weight = 0;
+                last_nop = i;
+            }
+        }
+        else
+        {
+            instruction->weight += pending;
+            pending = 0;
+        }
+    }
+    if (pending > 0)
+        exec_code[last_nop].weight = pending;
+}
+
+/**
+ * Removes the nops without weight from exec_code and remaps branch targets and original addresses.
+ * @return The number of removed instructions
+ */
+static int compact()
+{
+    static int new_index[MAX_NUM_INSTRUCTIONS + 1];
+    int count = 0;
+
+    merge_weights();
+
+    // Removed instructions map to the next instruction that is kept.
+    for (int i = 0; i < exec_count; i++)
+    {
+        new_index[i] = count;
+        if (exec_code[i].op != OP_NOP || exec_code[i].weight > 0)
+            count++;
+    }
+    new_index[exec_count] = count;
+
+    int removed = exec_count - count;
+    count = 0;
+    for (int i = 0; i < exec_count; i++)
+    {
+        if (exec_code[i].op == OP_NOP && exec_code[i].weight == 0)
+            continue;
+
+        ExecInstruction instruction = exec_code[i];
+        if (instruction.target >= 0 && instruction.target <= exec_count)
+            instruction.target = new_index[instruction.target];
+        exec_code[count++] = instruction;
+    }
+
+    for (int i = 0; i <= instruction_count; i++)
+        original_to_exec[i] = new_index[original_to_exec[i]];
+    exec_count = count;
+
+    return removed;
+}
+
+/**
+ * Optimizes the internal code stream in place. Must be called after load_program().
+ * The weights of the kept instructions include the removed ones, so budgets still count the
+ * instructions of the program.
+ * @return The number of removed instructions
+ */
+int optimize_program()
+{
+    if (exec_count == 0)
+        return 0;
+
+    build_blocks();
+    propagate_constants();
+    rewrite_constants();
+
+    // Folded branches change the graph.
+    build_blocks();
+    find_reachable();
+    eliminate_dead_code();
+
+    int removed = compact();
+    update_blocks();
+    return removed;
+}
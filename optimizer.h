@@ -0,0 +1,10 @@
+/**
+ * Header file for the optimizer module.
+ * This module optimizes the internal code stream between assembling and executing.
+ */
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+int optimize_program();
+
+#endif // OPTIMIZER_H
\ No newline at end of file
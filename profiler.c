@@ -0,0 +1,309 @@
+/**
+ * Implementation of the profiler module.
+ * Host cycles, instructions, branch misses and L1D read misses are counted as one perf event group,
+ * so all counters cover the same code. The counters are read whenever the emulator changes phase.
+ * For the guest blocks, the first counter interrupts the emulator every sample_period events and the
+ * signal handler adds the counts since the previous sample to the block the executor published last.
+ * The attribution is statistical: a block is charged for the work since the previous sample, so long
+ * runs give accurate relative numbers while single samples are approximate.
+ * Where hardware events are not available, e.g. in virtual machines, the task clock drives the
+ * samples instead and the missing counters are reported as unavailable.
+ */
+#include "profiler.h"
+#include "assembler.h"
+#include "execute.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define NUM_COUNTERS 4
+
+typedef struct counter_spec
+{
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} CounterSpec;
+
+static CounterSpec counter_specs[NUM_COUNTERS] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"L1D-misses", PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+};
+
+// Replaces the cycles counter when the host has no hardware events.
+static const CounterSpec task_clock_spec = {"task-clock-ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK};
+
+static const char *phase_names[NUM_PHASES] = {"assemble", "load", "execute"};
+
+static int profiling = 0;
+static int counter_fd[NUM_COUNTERS];
+static int counter_slot[NUM_COUNTERS]; // Position in the group read, or -1 if unavailable
+static int num_slots;
+
+static ProfilePhase current_phase = PHASE_NONE;
+static uint64_t phase_start[NUM_COUNTERS];
+static uint64_t phase_counts[NUM_PHASES][NUM_COUNTERS];
+
+// Counts by internal instruction at the start of a block, the last row is time outside guest code.
+static uint64_t block_counts[MAX_NUM_INSTRUCTIONS + 1][NUM_COUNTERS];
+static uint64_t block_samples[MAX_NUM_INSTRUCTIONS + 1];
+static uint64_t last_sample[NUM_COUNTERS];
+
+static struct sigaction previous_action;
+
+static int open_counter(const CounterSpec *spec, int group, uint64_t sample_period)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = spec->type;
+    attr.config = spec->config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    if (group == -1)
+    {
+        attr.disabled = 1;
+        attr.sample_period = sample_period;
+        attr.wakeup_events = 1;
+    }
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+/**
+ * Read the counters of the group. Safe to call from the signal handler.
+ */
+static void read_counters(uint64_t values[NUM_COUNTERS])
+{
+    uint64_t buffer[1 + NUM_COUNTERS];
+    memset(buffer, 0, sizeof(buffer));
+    if (read(counter_fd[0], buffer, sizeof(buffer)) <= 0)
+        buffer[0] = 0;
+
+    for (int i = 0; i < NUM_COUNTERS; i++)
+        values[i] = counter_slot[i] != -1 && (uint64_t)counter_slot[i] < buffer[0] ? buffer[1 + counter_slot[i]] : 0;
+}
+
+/**
+ * Charges the counts since the previous sample to the block the executor runs.
+ */
+static void on_sample(int signal)
+{
+    (void)signal;
+    int saved_errno = errno;
+    int block = current_block;
+    int row = block >= 0 && block < MAX_NUM_INSTRUCTIONS ? block : MAX_NUM_INSTRUCTIONS;
+    uint64_t values[NUM_COUNTERS];
+
+    read_counters(values);
+    for (int i = 0; i < NUM_COUNTERS; i++)
+    {
+        block_counts[row][i] += values[i] - last_sample[i];
+        last_sample[i] = values[i];
+    }
+    block_samples[row]++;
+
+    // The leader disables itself after each overflow.
+    ioctl(counter_fd[0], PERF_EVENT_IOC_REFRESH, 1);
+    errno = saved_errno;
+}
+
+/**
+ * Starts counting and sampling host events.
+ * @param sample_period Number of events of the first counter between samples
+ * @return 0 on success, -1 if the counters cannot be opened
+ */
+int start_profiling(uint64_t sample_period)
+{
+    stop_profiling();
+    memset(phase_counts, 0, sizeof(phase_counts));
+    memset(block_counts, 0, sizeof(block_counts));
+    memset(block_samples, 0, sizeof(block_samples));
+    memset(last_sample, 0, sizeof(last_sample));
+
+    counter_fd[0] = open_counter(&counter_specs[0], -1, sample_period);
+    if (counter_fd[0] == -1)
+    {
+        counter_specs[0] = task_clock_spec;
+        counter_fd[0] = open_counter(&counter_specs[0], -1, sample_period);
+    }
+    if (counter_fd[0] == -1)
+    {
+        fprintf(stderr, "Error: Could not open performance counters: %s\n", strerror(errno));
+        return -1;
+    }
+
+    counter_slot[0] = 0;
+    num_slots = 1;
+    for (int i = 1; i < NUM_COUNTERS; i++)
+    {
+        counter_fd[i] = open_counter(&counter_specs[i], counter_fd[0], 0);
+        counter_slot[i] = counter_fd[i] == -1 ? -1 : num_slots++;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_sample;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGIO, &action, &previous_action);
+
+    fcntl(counter_fd[0], F_SETFL, O_ASYNC);
+    fcntl(counter_fd[0], F_SETOWN, getpid());
+
+    profiling = 1;
+    current_phase = PHASE_NONE;
+    ioctl(counter_fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(counter_fd[0], PERF_EVENT_IOC_REFRESH, 1);
+    return 0;
+}
+
+/**
+ * Stops counting. The counts are kept for print_profile().
+ */
+void stop_profiling()
+{
+    if (!profiling)
+        return;
+
+    set_profile_phase(PHASE_NONE);
+    ioctl(counter_fd[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    sigaction(SIGIO, &previous_action, NULL);
+    for (int i = NUM_COUNTERS - 1; i >= 0; i--)
+        if (counter_slot[i] != -1)
+            close(counter_fd[i]);
+    profiling = 0;
+}
+
+/**
+ * Charges the counts since the last phase change to the current phase and starts another.
+ * @param phase The new phase, or PHASE_NONE for work that is not charged to a phase
+ */
+void set_profile_phase(ProfilePhase phase)
+{
+    if (!profiling)
+        return;
+
+    uint64_t values[NUM_COUNTERS];
+    read_counters(values);
+    if (current_phase != PHASE_NONE)
+        for (int i = 0; i < NUM_COUNTERS; i++)
+            phase_counts[current_phase][i] += values[i] - phase_start[i];
+
+    for (int i = 0; i < NUM_COUNTERS; i++)
+        phase_start[i] = values[i];
+    current_phase = phase;
+}
+
+static void print_counts(const uint64_t counts[NUM_COUNTERS])
+{
+    for (int i = 0; i < NUM_COUNTERS; i++)
+        if (counter_slot[i] == -1)
+            printf(" %14s", "-");
+        else
+            printf(" %14llu", (unsigned long long)counts[i]);
+    printf("\n");
+}
+
+/**
+ * Orders rows of block_samples by their samples, most first.
+ */
+static int compare_samples(const void *a, const void *b)
+{
+    uint64_t samples_a = block_samples[*(const int *)a];
+    uint64_t samples_b = block_samples[*(const int *)b];
+    return samples_a < samples_b ? 1 : samples_a > samples_b ? -1 : 0;
+}
+
+static void print_header(const char *first, int with_samples)
+{
+    printf("%-32s", first);
+    if (with_samples)
+        printf(" %8s", "samples");
+    for (int i = 0; i < NUM_COUNTERS; i++)
+        printf(" %14s", counter_specs[i].name);
+    printf("\n");
+}
+
+/**
+ * Print the counts by phase and by guest block, blocks with the most samples first.
+ * Counters the host does not support are shown as -.
+ */
+void print_profile()
+{
+    printf("\nHost counters by phase:\n");
+    print_header("phase", 0);
+    for (int p = 0; p < NUM_PHASES; p++)
+    {
+        printf("%-32s", phase_names[p]);
+        print_counts(phase_counts[p]);
+    }
+
+    printf("\nHost counters by guest block:\n");
+    print_header("block", 1);
+    static int rows[MAX_NUM_INSTRUCTIONS + 1];
+    int row_count = 0;
+    for (int i = 0; i <= MAX_NUM_INSTRUCTIONS; i++)
+        if (block_samples[i] > 0)
+            rows[row_count++] = i;
+    qsort(rows, row_count, sizeof(int), compare_samples);
+
+    for (int r = 0; r < row_count; r++)
+    {
+        int best = rows[r];
+        char name[64];
+        if (best == MAX_NUM_INSTRUCTIONS)
+            snprintf(name, sizeof(name), "(outside guest code)");
+        else
+        {
+            uint32_t pc = get_original_pc(best);
+            int offset;
+            char *label = get_label_before((pc - INIT_PC) / 4, &offset);
+            if (label != NULL)
+                snprintf(name, sizeof(name), "0x%08x %s+%d", pc, label, offset);
+            else
+                snprintf(name, sizeof(name), "0x%08x", pc);
+        }
+        printf("%-32s %8llu", name, (unsigned long long)block_samples[best]);
+        print_counts(block_counts[best]);
+    }
+}
+
+#else
+
+int start_profiling(uint64_t sample_period)
+{
+    (void)sample_period;
+    fprintf(stderr, "Error: Performance counters are only supported on Linux.\n");
+    return -1;
+}
+
+void stop_profiling()
+{
+}
+
+void set_profile_phase(ProfilePhase phase)
+{
+    (void)phase;
+}
+
+void print_profile()
+{
+}
+
+#endif
@@ -0,0 +1,27 @@
+/**
+ * Header file for the profiler module.
+ * This module counts host hardware events with perf_event_open while the emulator runs and attributes
+ * them to emulator phases and to guest basic blocks. It is only available on Linux.
+ */
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+
+#define DEFAULT_SAMPLE_PERIOD 100000 // Events of the first counter between samples
+
+typedef enum profile_phase
+{
+    PHASE_NONE = -1,
+    PHASE_ASSEMBLE,
+    PHASE_LOAD,
+    PHASE_EXECUTE,
+    NUM_PHASES
+} ProfilePhase;
+
+int start_profiling(uint64_t sample_period);
+void stop_profiling();
+void set_profile_phase(ProfilePhase phase);
+void print_profile();
+
+#endif // PROFILER_H
\ No newline at end of file
@@ -162,7 +162,7 @@ int get_register_index_by_name(const char *name)
 }
 
 /**
- * Set the register entry by index. Stores negative values as twos complement.
+ * Set the register entry by index. Negative values are stored as twos complement.
  * @param index The index of the register entry.
  * @param value The value to be set.
  */
@@ -174,20 +174,13 @@ void set_register_by_index(int index, int value)
     }
     else
     {
-        // Check if the value is negative
-        if (value < 0)
-        {
-            // Convert the value to twos complement (32-bit)
-            value = ~value;
-            value = value + 1;
-        }
         // Store the value
         REGISTER_TABLE.registers[index]->value = value;
     }
 }
 
 /**
- * Set the register entry by name. Stores negative values as twos complement.
+ * Set the register entry by name. Negative values are stored as twos complement.
  * @param name The name of the register entry.
  * @param value The value to be set.
  */
@@ -197,13 +190,6 @@ void set_register_by_name(const char *name, int value)
     {
         if (strcmp(REGISTER_TABLE.registers[i]->name, name) == 0)
         {
-            // Check if the value is negative
-            if (value < 0)
-            {
-                // Convert the value to twos complement (32-bit)
-                value = ~value;
-                value = value + 1;
-            }
             // Store the value
             REGISTER_TABLE.registers[i]->value = value;
             return;
@@ -214,13 +200,6 @@ void set_register_by_name(const char *name, int value)
     {
         if (strcmp(REGISTER_TABLE.specialRegisters[i]->name, name) == 0)
         {
-            // Check if the value is negative
-            if (value < 0)
-            {
-                // Convert the value to twos complement (32-bit)
-                value = ~value;
-                value = value + 1;
-            }
             // Store the value
             REGISTER_TABLE.specialRegisters[i]->value = value;
             return;
@@ -268,3 +247,40 @@ void jump_pc(int value)
         REGISTER_TABLE.specialRegisters[0]->value = INIT_PC;
     }
 }
+
+
+/**
+ * Get the value of the hi register.
+ * @return The value of the hi register.
+ */
+int get_hi()
+{
+    return REGISTER_TABLE.specialRegisters[1]->value;
+}
+
+/**
+ * Set the value of the hi register.
+ * @param value The value to be set.
+ */
+void set_hi(int value)
+{
+    REGISTER_TABLE.specialRegisters[1]->value = value;
+}
+
+/**
+ * Get the value of the lo register.
+ * @return The value of the lo register.
+ */
+int get_lo()
+{
+    return REGISTER_TABLE.specialRegisters[2]->value;
+}
+
+/**
+ * Set the value of the lo register.
+ * @param value The value to be set.
+ */
+void set_lo(int value)
+{
+    REGISTER_TABLE.specialRegisters[2]->value = value;
+}
\ No newline at end of file
@@ -35,4 +35,10 @@ void set_pc(int value);
 void increment_pc();
 void jump_pc(int value);
 
+// Functions for hi and lo
+int get_hi();
+void set_hi(int value);
+int get_lo();
+void set_lo(int value);
+
 #endif // REGISTER_H
\ No newline at end of file
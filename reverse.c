@@ -0,0 +1,461 @@
+/**
+ * Implementation of the reverse execution module.
+ * While recording, a checkpoint of the registers is taken every interval instructions, keeping the
+ * latest max_checkpoints. Guest memory is not copied: each checkpoint keeps the pages written after
+ * it, saved on their first write. Between checkpoints an undo log keeps the old value of every register
+ * write and store and the pc at the start of every block. Going back to an earlier instruction undoes
+ * the log to the block containing it, or restores the closest earlier checkpoint, and then executes
+ * forward to the exact instruction, so it takes time proportional to the checkpoint interval.
+ * Memory use is bounded by max_checkpoints checkpoints with the pages written in their interval and
+ * an undo log of 2 * interval entries, which grows when stops start extra blocks. Changes the debugger
+ * makes to the state cannot be replayed, so they drop the recorded history.
+ */
+#include "reverse.h"
+#include "debugger.h"
+#include "memory.h"
+#include "register.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct checkpoint
+{
+    uint64_t time;
+    int registers[REGISTER_TABLE_SIZE];
+    int hi, lo;
+    int pc;
+
+    // Pages written after the checkpoint, with their contents at the checkpoint.
+    uint32_t *page_addresses;
+    uint8_t *pages;
+    int page_count, page_capacity;
+} Checkpoint;
+
+// Kinds of undo log entries.
+#define UNDO_BLOCK 0    // A block started at time at pc
+#define UNDO_REGISTER 1 // Register index held value
+#define UNDO_HILO 2     // hi and lo held value and value2
+#define UNDO_MEMORY 3   // The index bytes at address value held value2
+
+typedef struct undo_entry
+{
+    uint8_t kind;
+    uint8_t index;
+    int value, value2;
+    uint64_t time;
+} UndoEntry;
+
+static int recording = 0;
+static uint64_t checkpoint_interval;
+
+// Ring buffer of checkpoints, oldest first from checkpoint_first.
+static Checkpoint *checkpoints = NULL;
+static int max_checkpoints;
+static int checkpoint_first;
+static int checkpoint_count;
+
+static UndoEntry *undo_log = NULL;
+static int undo_capacity;
+static int undo_count;
+
+// Marks the pages saved since the latest checkpoint.
+static uint8_t *page_saved = NULL;
+
+static Checkpoint *get_checkpoint(int number)
+{
+    return &checkpoints[(checkpoint_first + number) % max_checkpoints];
+}
+
+static void log_entry(uint8_t kind, int index, int value, int value2, uint64_t time)
+{
+    // One block and one write per instruction of an interval fit, but every stop at a breakpoint or
+    // watchpoint starts another block.
+    if (undo_count == undo_capacity)
+    {
+        UndoEntry *log = (UndoEntry *)realloc(undo_log, 2 * (size_t)undo_capacity * sizeof(UndoEntry));
+        if (log == NULL)
+        {
+            fprintf(stderr, "Error: Could not allocate memory for recording.\n");
+            exit(1);
+        }
+        undo_log = log;
+        undo_capacity *= 2;
+    }
+
+    UndoEntry *entry = &undo_log[undo_count++];
+    entry->kind = kind;
+    entry->index = index;
+    entry->value = value;
+    entry->value2 = value2;
+    entry->time = time;
+}
+
+static void record_block(int index, uint64_t time)
+{
+    log_entry(UNDO_BLOCK, 0, get_original_pc(index), 0, time);
+}
+
+static void record_register(int index, int value)
+{
+    if (index == 0)
+        return;
+
+    log_entry(UNDO_REGISTER, index, get_register_value(index), 0, 0);
+    set_register_by_index(index, value);
+}
+
+static void record_hilo(int hi, int lo)
+{
+    log_entry(UNDO_HILO, 0, get_hi(), get_lo(), 0);
+    set_hi(hi);
+    set_lo(lo);
+}
+
+/**
+ * Save the contents of a page in the latest checkpoint before it is first written.
+ */
+static void save_page(uint32_t address)
+{
+    int page = get_memory_page(address);
+    if (page_saved[page])
+        return;
+
+    Checkpoint *checkpoint = get_checkpoint(checkpoint_count - 1);
+    if (checkpoint->page_count == checkpoint->page_capacity)
+    {
+        int capacity = checkpoint->page_capacity == 0 ? 16 : checkpoint->page_capacity * 2;
+        uint32_t *page_addresses = (uint32_t *)realloc(checkpoint->page_addresses, capacity * sizeof(uint32_t));
+        if (page_addresses != NULL)
+            checkpoint->page_addresses = page_addresses;
+        uint8_t *pages = (uint8_t *)realloc(checkpoint->pages, (size_t)capacity * MEMORY_PAGE_SIZE);
+        if (page_addresses == NULL || pages == NULL)
+        {
+            fprintf(stderr, "Error: Could not allocate memory for recording.\n");
+            exit(1);
+        }
+        checkpoint->pages = pages;
+        checkpoint->page_capacity = capacity;
+    }
+
+    uint32_t page_address = get_memory_page_address(page);
+    checkpoint->page_addresses[checkpoint->page_count] = page_address;
+    memcpy(checkpoint->pages + (size_t)checkpoint->page_count * MEMORY_PAGE_SIZE,
+           get_memory_pointer(page_address, MEMORY_PAGE_SIZE), MEMORY_PAGE_SIZE);
+    checkpoint->page_count++;
+    page_saved[page] = 1;
+}
+
+static void record_memory(uint32_t address, int size, uint32_t value)
+{
+    uint32_t old_value;
+    load_memory(address, size, &old_value);
+    log_entry(UNDO_MEMORY, size, address, old_value, 0);
+    save_page(address);
+    store_memory(address, size, value);
+}
+
+/**
+ * Take a checkpoint at the current time and clear the undo log.
+ */
+static void take_checkpoint()
+{
+    // Pages are saved again in the new interval.
+    if (checkpoint_count > 0)
+    {
+        Checkpoint *previous = get_checkpoint(checkpoint_count - 1);
+        for (int i = 0; i < previous->page_count; i++)
+            page_saved[get_memory_page(previous->page_addresses[i])] = 0;
+    }
+
+    if (checkpoint_count == max_checkpoints)
+    {
+        checkpoint_first = (checkpoint_first + 1) % max_checkpoints;
+        checkpoint_count--;
+    }
+
+    Checkpoint *checkpoint = get_checkpoint(checkpoint_count++);
+    checkpoint->page_count = 0;
+    checkpoint->time = exec_time;
+    for (int i = 0; i < REGISTER_TABLE_SIZE; i++)
+        checkpoint->registers[i] = get_register_value(i);
+    checkpoint->hi = get_hi();
+    checkpoint->lo = get_lo();
+    checkpoint->pc = get_pc();
+
+    undo_count = 0;
+}
+
+/**
+ * Restore a checkpoint. The later checkpoints and the undo log are dropped, executing forward
+ * creates them again.
+ * @param number The number of the checkpoint, 0 is the oldest
+ */
+static void restore_checkpoint(int number)
+{
+    // Put back the pages written since the checkpoint, newest interval first.
+    for (int later = checkpoint_count - 1; later >= number; later--)
+    {
+        Checkpoint *checkpoint = get_checkpoint(later);
+        for (int i = 0; i < checkpoint->page_count; i++)
+            memcpy(get_memory_pointer(checkpoint->page_addresses[i], MEMORY_PAGE_SIZE),
+                   checkpoint->pages + (size_t)i * MEMORY_PAGE_SIZE, MEMORY_PAGE_SIZE);
+        checkpoint->page_count = 0;
+    }
+    memset(page_saved, 0, get_memory_page_count());
+
+    Checkpoint *checkpoint = get_checkpoint(number);
+    for (int i = 1; i < REGISTER_TABLE_SIZE; i++)
+        set_register_by_index(i, checkpoint->registers[i]);
+    set_hi(checkpoint->hi);
+    set_lo(checkpoint->lo);
+    set_pc((checkpoint->pc - INIT_PC) / 4);
+    exec_time = checkpoint->time;
+
+    checkpoint_count = number + 1;
+    undo_count = 0;
+    set_resume_pc(0);
+}
+
+/**
+ * Start recording. Stops a previous recording.
+ * @param interval Number of instructions between checkpoints
+ * @param count Maximum number of checkpoints kept
+ * @return 0 on success, -1 if memory cannot be allocated
+ */
+int start_recording(uint64_t interval, int count)
+{
+    stop_recording();
+    if (interval == 0 || count <= 0)
+        return -1;
+
+    max_checkpoints = count;
+    checkpoints = (Checkpoint *)calloc(count, sizeof(Checkpoint));
+    undo_log = (UndoEntry *)malloc((2 * interval + 1) * sizeof(UndoEntry));
+    page_saved = (uint8_t *)calloc(get_memory_page_count(), 1);
+    if (checkpoints == NULL || undo_log == NULL || page_saved == NULL)
+    {
+        fprintf(stderr, "Error: Could not allocate memory for recording.\n");
+        stop_recording();
+        return -1;
+    }
+
+    checkpoint_interval = interval;
+    checkpoint_first = 0;
+    checkpoint_count = 0;
+    undo_capacity = 2 * interval + 1;
+    recording = 1;
+
+    take_checkpoint();
+    set_block_hook(record_block);
+    set_base_register_writer(record_register);
+    set_hilo_writer(record_hilo);
+    set_memory_writer(record_memory);
+    return 0;
+}
+
+/**
+ * Drop the recorded history and record from the current state on. Used when the state is changed
+ * from outside the program, which executing forward from a checkpoint would not repeat.
+ */
+void restart_recording()
+{
+    if (!recording)
+        return;
+
+    for (int i = 0; i < checkpoint_count; i++)
+        get_checkpoint(i)->page_count = 0;
+    memset(page_saved, 0, get_memory_page_count());
+    checkpoint_first = 0;
+    checkpoint_count = 0;
+    take_checkpoint();
+}
+
+/**
+ * Stop recording and free the checkpoints and the undo log.
+ */
+void stop_recording()
+{
+    if (recording)
+    {
+        set_block_hook(NULL);
+        set_base_register_writer(NULL);
+        set_hilo_writer(NULL);
+        set_memory_writer(NULL);
+    }
+
+    for (int i = 0; checkpoints != NULL && i < max_checkpoints; i++)
+    {
+        free(checkpoints[i].page_addresses);
+        free(checkpoints[i].pages);
+    }
+    free(checkpoints);
+    free(undo_log);
+    free(page_saved);
+    checkpoints = NULL;
+    undo_log = NULL;
+    page_saved = NULL;
+    recording = 0;
+}
+
+/**
+ * Runs the program from the current pc, taking checkpoints while recording.
+ * @param budget Maximum number of instructions to execute, EXEC_UNLIMITED for no limit
+ * @return The result of the run
+ */
+ExecResult record_run(uint64_t budget)
+{
+    if (!recording)
+        return debug_run(budget);
+
+    uint64_t retired = 0;
+    for (;;)
+    {
+        // Stop at the next checkpoint.
+        uint64_t next_checkpoint = get_checkpoint(checkpoint_count - 1)->time + checkpoint_interval;
+        uint64_t chunk = next_checkpoint - exec_time;
+        if (budget - retired < chunk)
+            chunk = budget - retired;
+
+        ExecResult result = debug_run(chunk);
+        retired += result.retired;
+        if (exec_time == next_checkpoint)
+            take_checkpoint();
+
+        if (result.status != EXEC_BUDGET_EXHAUSTED || retired == budget)
+        {
+            result.retired = retired;
+            return result;
+        }
+    }
+}
+
+/**
+ * Executes forward until exec_time reaches a time, passing over breakpoints and watchpoints.
+ */
+static void replay_until(uint64_t time)
+{
+    while (exec_time < time)
+    {
+        ExecResult result = record_run(time - exec_time);
+        if (result.status != EXEC_BREAKPOINT && result.status != EXEC_WATCHPOINT)
+            break;
+    }
+}
+
+/**
+ * Go back to the state before an earlier instruction.
+ * @param time The exec_time to go back to
+ * @return The result with the pc at the given time, EXEC_BUDGET_EXHAUSTED if the time was reached
+ *         or EXEC_STOPPED if the recording does not go back that far and the oldest checkpoint was restored
+ */
+ExecResult reverse_to(uint64_t time)
+{
+    ExecResult result = {EXEC_BUDGET_EXHAUSTED, 0, get_pc()};
+    if (!recording || time > exec_time)
+    {
+        result.status = EXEC_STOPPED;
+        return result;
+    }
+
+    if (time <= get_checkpoint(0)->time)
+    {
+        time = get_checkpoint(0)->time;
+        result.status = EXEC_STOPPED;
+    }
+
+    int number = checkpoint_count - 1;
+    if (time >= get_checkpoint(number)->time)
+    {
+        // Undo the log back to the block containing the instruction.
+        while (undo_count > 0)
+        {
+            UndoEntry *entry = &undo_log[--undo_count];
+            if (entry->kind == UNDO_REGISTER)
+                set_register_by_index(entry->index, entry->value);
+            else if (entry->kind == UNDO_HILO)
+            {
+                set_hi(entry->value);
+                set_lo(entry->value2);
+            }
+            else if (entry->kind == UNDO_MEMORY)
+                store_memory(entry->value, entry->index, entry->value2);
+            else if (entry->time <= time)
+            {
+                set_pc((entry->value - INIT_PC) / 4);
+                exec_time = entry->time;
+                set_resume_pc(0);
+                break;
+            }
+        }
+        if (exec_time > time)
+            restore_checkpoint(number);
+    }
+    else
+    {
+        while (get_checkpoint(number)->time > time)
+            number--;
+        restore_checkpoint(number);
+    }
+
+    replay_until(time);
+    result.pc = get_pc();
+    return result;
+}
+
+/**
+ * Go back one instruction.
+ * @return The result, with the pc of the previous instruction
+ */
+ExecResult reverse_step()
+{
+    return reverse_to(exec_time > 0 ? exec_time - 1 : 0);
+}
+
+/**
+ * Go back to the last time a breakpoint or watchpoint stopped the program, or to the oldest
+ * checkpoint if there is none. Each checkpoint interval is executed again, newest first, to find
+ * the stops.
+ * @return The result, EXEC_BREAKPOINT or EXEC_WATCHPOINT at the stop or EXEC_STOPPED at the oldest checkpoint
+ */
+ExecResult reverse_continue()
+{
+    ExecResult result = {EXEC_STOPPED, 0, get_pc()};
+    if (!recording)
+        return result;
+
+    uint64_t now = exec_time;
+    for (int number = checkpoint_count - 1; number >= 0; number--)
+    {
+        uint64_t end = number == checkpoint_count - 1 ? now : get_checkpoint(number + 1)->time;
+        uint64_t stop_time = 0;
+        ExecStatus stop_status = EXEC_STOPPED;
+
+        restore_checkpoint(number);
+        while (exec_time < end)
+        {
+            ExecResult run = record_run(end - exec_time);
+            if (run.status != EXEC_BREAKPOINT && run.status != EXEC_WATCHPOINT)
+                break;
+            if (exec_time < now)
+            {
+                stop_time = exec_time;
+                stop_status = run.status;
+            }
+        }
+
+        if (stop_status != EXEC_STOPPED)
+        {
+            result = reverse_to(stop_time);
+            result.status = stop_status;
+            if (stop_status == EXEC_BREAKPOINT)
+                set_resume_pc(result.pc);
+            return result;
+        }
+
+        // Executing the interval again may have created the next checkpoint.
+        checkpoint_count = number + 1;
+    }
+
+    return reverse_to(get_checkpoint(0)->time);
+}
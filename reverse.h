@@ -0,0 +1,22 @@
+/**
+ * Header file for the reverse execution module.
+ * This module records periodic checkpoints and an undo log so the program can be run backwards.
+ */
+#ifndef REVERSE_H
+#define REVERSE_H
+
+#include <stdint.h>
+
+#include "execute.h"
+
+#define DEFAULT_CHECKPOINT_COUNT 64
+
+int start_recording(uint64_t interval, int count);
+void restart_recording();
+void stop_recording();
+ExecResult record_run(uint64_t budget);
+ExecResult reverse_to(uint64_t time);
+ExecResult reverse_step();
+ExecResult reverse_continue();
+
+#endif // REVERSE_H
\ No newline at end of file
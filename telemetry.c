@@ -0,0 +1,247 @@
+/**
+ * Implementation of the telemetry module.
+ * The executor only does cheap work per block while the segment exists: it counts the block entry and
+ * stores the retired count and the pc. The per-opcode and memory counters are derived from the
+ * entry counts every TELEMETRY_FOLD_BLOCKS blocks and at the end of a run once they are
+ * TELEMETRY_REFRESH_SECONDS old: every entry of a block counts each instruction of the block once,
+ * and the instructions of blocks that were cut short are subtracted again. Only the range of blocks
+ * entered since the last update is visited, and short runs such as fuzzing inputs do not update at
+ * all. Opcodes are taken from the bytecode, so optimized or patched instructions still count as the
+ * instruction they came from, and an instruction the optimizer merged removed instructions into
+ * counts each of them.
+ */
+#include "telemetry.h"
+#include "assembler.h"
+#include "execute.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+TelemetrySegment *telemetry = NULL;
+
+// Blocks entered at each internal instruction and instructions charged but not executed, since the
+// last update.
+uint64_t block_entries[MAX_NUM_INSTRUCTIONS];
+uint64_t block_unexecuted[MAX_NUM_INSTRUCTIONS];
+
+// Faults of each opcode since the last update. The removed instructions merged into a faulting
+// instruction ran, so only its own opcode is subtracted.
+uint64_t faulted_opcodes[NUM_INSTRUCTIONS];
+
+// Range of internal instructions with block entries or unexecuted instructions since the last update.
+int block_dirty_first = MAX_NUM_INSTRUCTIONS;
+int block_dirty_end = 0;
+
+static char segment_name[64];
+#ifdef _WIN32
+static HANDLE segment_handle = NULL;
+#endif
+
+// Retired count and time of the last rate measurement.
+static uint64_t rate_retired;
+static double rate_time;
+
+// Time of the last update of the derived counters.
+static double update_time;
+
+static double get_seconds()
+{
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Creates the shared memory segment of this process and starts publishing statistics.
+ * @return 0 on success, -1 if the segment cannot be created
+ */
+int start_telemetry()
+{
+    stop_telemetry();
+
+#ifdef _WIN32
+    uint32_t pid = GetCurrentProcessId();
+    snprintf(segment_name, sizeof(segment_name), "Local\\" TELEMETRY_NAME_FORMAT, pid);
+    segment_handle = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(TelemetrySegment), segment_name);
+    if (segment_handle == NULL)
+    {
+        fprintf(stderr, "Error: Could not create telemetry segment %s.\n", segment_name);
+        return -1;
+    }
+    telemetry = (TelemetrySegment *)MapViewOfFile(segment_handle, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(TelemetrySegment));
+    if (telemetry == NULL)
+    {
+        fprintf(stderr, "Error: Could not map telemetry segment %s.\n", segment_name);
+        CloseHandle(segment_handle);
+        segment_handle = NULL;
+        return -1;
+    }
+#else
+    uint32_t pid = getpid();
+    snprintf(segment_name, sizeof(segment_name), "/" TELEMETRY_NAME_FORMAT, pid);
+    int fd = shm_open(segment_name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd == -1 || ftruncate(fd, sizeof(TelemetrySegment)) != 0)
+    {
+        fprintf(stderr, "Error: Could not create telemetry segment %s.\n", segment_name);
+        if (fd != -1)
+        {
+            close(fd);
+            shm_unlink(segment_name);
+        }
+        return -1;
+    }
+    void *segment = mmap(NULL, sizeof(TelemetrySegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED)
+    {
+        fprintf(stderr, "Error: Could not map telemetry segment %s.\n", segment_name);
+        shm_unlink(segment_name);
+        return -1;
+    }
+    telemetry = (TelemetrySegment *)segment;
+#endif
+
+    memset(telemetry, 0, sizeof(TelemetrySegment));
+    memset(block_entries, 0, sizeof(block_entries));
+    memset(block_unexecuted, 0, sizeof(block_unexecuted));
+    memset(faulted_opcodes, 0, sizeof(faulted_opcodes));
+    block_dirty_first = MAX_NUM_INSTRUCTIONS;
+    block_dirty_end = 0;
+    telemetry->version = TELEMETRY_VERSION;
+    telemetry->pid = pid;
+    telemetry->num_opcodes = NUM_INSTRUCTIONS;
+    for (int i = 0; i < NUM_INSTRUCTIONS; i++)
+        strncpy(telemetry->opcode_names[i], get_instruction_name(i), TELEMETRY_NAME_LENGTH - 1);
+
+    rate_retired = exec_time;
+    rate_time = get_seconds();
+    atomic_store_explicit(&telemetry->running, 1, memory_order_relaxed);
+
+    // Readers check the magic number last.
+    atomic_thread_fence(memory_order_release);
+    telemetry->magic = TELEMETRY_MAGIC;
+
+    printf("Telemetry published in %s\n", segment_name);
+    return 0;
+}
+
+/**
+ * Stops publishing statistics and removes the segment.
+ */
+void stop_telemetry()
+{
+    if (telemetry == NULL)
+        return;
+
+    update_telemetry();
+    atomic_store_explicit(&telemetry->running, 0, memory_order_relaxed);
+
+#ifdef _WIN32
+    UnmapViewOfFile(telemetry);
+    CloseHandle(segment_handle);
+    segment_handle = NULL;
+#else
+    munmap(telemetry, sizeof(TelemetrySegment));
+    shm_unlink(segment_name);
+#endif
+    telemetry = NULL;
+}
+
+static void add_counter(_Atomic uint64_t *counter, uint64_t value)
+{
+    // The emulator is the only writer, so the read and the write need not be one atomic operation.
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+/**
+ * Adds to the counts of the program instructions an internal instruction stands for.
+ */
+static void count_opcodes(uint64_t *counts, int index, uint64_t value)
+{
+    int last = exec_code[index].original_index;
+    for (int i = last - exec_code[index].weight + 1; i <= last; i++)
+        counts[decode_instruction(bytecode[i])] += value;
+}
+
+/**
+ * Derives the opcode and memory counters from the block entries and updates the rate. Must be called
+ * before the internal code stream or its blocks change.
+ */
+void update_telemetry()
+{
+    if (telemetry == NULL)
+        return;
+
+    uint64_t counts[NUM_INSTRUCTIONS];
+    memset(counts, 0, sizeof(counts));
+
+    for (int i = block_dirty_first; i < block_dirty_end && i < exec_count; i++)
+    {
+        if (block_entries[i] != 0)
+        {
+            uint32_t length = get_block_length(i);
+            for (int j = i; j < exec_count && j < i + (int)length; j++)
+                count_opcodes(counts, j, block_entries[i]);
+            block_entries[i] = 0;
+        }
+        if (block_unexecuted[i] != 0)
+        {
+            count_opcodes(counts, i, 0 - block_unexecuted[i]);
+            block_unexecuted[i] = 0;
+        }
+    }
+
+    for (int op = 0; op < NUM_INSTRUCTIONS; op++)
+    {
+        counts[op] -= faulted_opcodes[op];
+        faulted_opcodes[op] = 0;
+        if (counts[op] == 0)
+            continue;
+        add_counter(&telemetry->opcode_counts[op], counts[op]);
+
+        if (op == INSTR_LB || op == INSTR_LBU || op == INSTR_LH || op == INSTR_LHU || op == INSTR_LW)
+        {
+            add_counter(&telemetry->loads, counts[op]);
+            add_counter(&telemetry->bytes_loaded, counts[op] * get_access_size(op));
+        }
+        else if (op == INSTR_SB || op == INSTR_SH || op == INSTR_SW)
+        {
+            add_counter(&telemetry->stores, counts[op]);
+            add_counter(&telemetry->bytes_stored, counts[op] * get_access_size(op));
+        }
+    }
+    block_dirty_first = MAX_NUM_INSTRUCTIONS;
+    block_dirty_end = 0;
+    atomic_store_explicit(&telemetry->data_segment_size, data_size, memory_order_relaxed);
+
+    // The rate is measured over at least a tenth of a second. Going backwards counts as no progress.
+    double now = get_seconds();
+    update_time = now;
+    if (now - rate_time >= 0.1)
+    {
+        uint64_t retired = atomic_load_explicit(&telemetry->retired, memory_order_relaxed);
+        uint64_t rate = retired > rate_retired ? (uint64_t)((retired - rate_retired) / (now - rate_time)) : 0;
+        atomic_store_explicit(&telemetry->instructions_per_second, rate, memory_order_relaxed);
+        rate_retired = retired;
+        rate_time = now;
+    }
+}
+
+/**
+ * Updates the derived counters if they are TELEMETRY_REFRESH_SECONDS old. Called at the end of every
+ * run, so that a run costs the same however large the program is.
+ */
+void refresh_telemetry()
+{
+    if (telemetry != NULL && get_seconds() - update_time >= TELEMETRY_REFRESH_SECONDS)
+        update_telemetry();
+}
@@ -0,0 +1,57 @@
+/**
+ * Header file for the telemetry module.
+ * A running emulator publishes its statistics in a shared memory segment named after its process id,
+ * which a reader such as telemetry_reader maps to watch the emulator without stopping it. Only the
+ * emulator writes the segment, all counters use relaxed atomics.
+ */
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "assembler.h"
+#include "instruction.h"
+
+#define TELEMETRY_MAGIC 0x4D495053 // "MIPS"
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_NAME_FORMAT "mips_emulator.%u"
+#define TELEMETRY_NAME_LENGTH 8
+#define TELEMETRY_FOLD_BLOCKS 65536   // Blocks between updates of the derived counters
+#define TELEMETRY_REFRESH_SECONDS 0.1 // Age of the derived counters before a run end updates them
+
+typedef struct telemetry_segment
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t pid;
+    uint32_t num_opcodes;
+    char opcode_names[NUM_INSTRUCTIONS][TELEMETRY_NAME_LENGTH];
+
+    _Atomic uint32_t running; // Cleared when the emulator stops publishing
+
+    // Updated at every block boundary.
+    _Atomic uint64_t retired;
+    _Atomic uint32_t pc;
+
+    // Updated every TELEMETRY_FOLD_BLOCKS blocks and when a run ends TELEMETRY_REFRESH_SECONDS after
+    // the last update.
+    _Atomic uint64_t instructions_per_second;
+    _Atomic uint64_t opcode_counts[NUM_INSTRUCTIONS]; // Indexed by InstructionId
+    _Atomic uint64_t loads, stores;
+    _Atomic uint64_t bytes_loaded, bytes_stored;
+    _Atomic uint32_t data_segment_size;
+} TelemetrySegment;
+
+extern TelemetrySegment *telemetry;
+extern uint64_t block_entries[MAX_NUM_INSTRUCTIONS];
+extern uint64_t block_unexecuted[MAX_NUM_INSTRUCTIONS];
+extern uint64_t faulted_opcodes[NUM_INSTRUCTIONS];
+extern int block_dirty_first, block_dirty_end;
+
+int start_telemetry();
+void stop_telemetry();
+void update_telemetry();
+void refresh_telemetry();
+
+#endif // TELEMETRY_H
\ No newline at end of file
@@ -0,0 +1,160 @@
+/**
+ * Reader for the telemetry segment of a running emulator.
+ * Attaches to the segment of a process read only and prints the statistics, once or repeatedly, as a
+ * table or as one JSON object per line for export.
+ *
+ * Usage: telemetry_reader <pid> [-i seconds] [-j]
+ */
+#include "telemetry.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static void usage()
+{
+    printf("./telemetry_reader <pid> [-i seconds] [-j]\n");
+}
+
+/**
+ * Map the segment of a process read only.
+ * @return The segment, or NULL if the process publishes none
+ */
+static const TelemetrySegment *attach(unsigned pid)
+{
+    char name[64];
+    const TelemetrySegment *segment;
+
+#ifdef _WIN32
+    snprintf(name, sizeof(name), "Local\\" TELEMETRY_NAME_FORMAT, pid);
+    HANDLE handle = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+    if (handle == NULL)
+        return NULL;
+    segment = (const TelemetrySegment *)MapViewOfFile(handle, FILE_MAP_READ, 0, 0, sizeof(TelemetrySegment));
+#else
+    snprintf(name, sizeof(name), "/" TELEMETRY_NAME_FORMAT, pid);
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1)
+        return NULL;
+    void *mapping = mmap(NULL, sizeof(TelemetrySegment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    segment = mapping == MAP_FAILED ? NULL : (const TelemetrySegment *)mapping;
+#endif
+
+    if (segment == NULL || segment->magic != TELEMETRY_MAGIC)
+        return NULL;
+    atomic_thread_fence(memory_order_acquire);
+
+    if (segment->version != TELEMETRY_VERSION || segment->num_opcodes != NUM_INSTRUCTIONS)
+    {
+        fprintf(stderr, "Error: Segment of process %u has another layout.\n", pid);
+        exit(1);
+    }
+    return segment;
+}
+
+static uint64_t get(const _Atomic uint64_t *counter)
+{
+    return atomic_load_explicit((_Atomic uint64_t *)counter, memory_order_relaxed);
+}
+
+static void print_table(const TelemetrySegment *segment)
+{
+    printf("pid %u  retired %llu  pc 0x%08x  %llu instructions/s\n", segment->pid,
+           (unsigned long long)get(&segment->retired),
+           atomic_load_explicit((_Atomic uint32_t *)&segment->pc, memory_order_relaxed),
+           (unsigned long long)get(&segment->instructions_per_second));
+    printf("loads %llu (%llu bytes)  stores %llu (%llu bytes)  data segment %u bytes\n",
+           (unsigned long long)get(&segment->loads), (unsigned long long)get(&segment->bytes_loaded),
+           (unsigned long long)get(&segment->stores), (unsigned long long)get(&segment->bytes_stored),
+           atomic_load_explicit((_Atomic uint32_t *)&segment->data_segment_size, memory_order_relaxed));
+
+    for (int i = 0; i < NUM_INSTRUCTIONS; i++)
+    {
+        uint64_t count = get(&segment->opcode_counts[i]);
+        if (count != 0)
+            printf("  %-8s %llu\n", segment->opcode_names[i], (unsigned long long)count);
+    }
+    printf("\n");
+}
+
+static void print_json(const TelemetrySegment *segment)
+{
+    printf("{\"pid\":%u,\"retired\":%llu,\"pc\":%u,\"instructions_per_second\":%llu,", segment->pid,
+           (unsigned long long)get(&segment->retired),
+           atomic_load_explicit((_Atomic uint32_t *)&segment->pc, memory_order_relaxed),
+           (unsigned long long)get(&segment->instructions_per_second));
+    printf("\"loads\":%llu,\"bytes_loaded\":%llu,\"stores\":%llu,\"bytes_stored\":%llu,\"data_segment_size\":%u,",
+           (unsigned long long)get(&segment->loads), (unsigned long long)get(&segment->bytes_loaded),
+           (unsigned long long)get(&segment->stores), (unsigned long long)get(&segment->bytes_stored),
+           atomic_load_explicit((_Atomic uint32_t *)&segment->data_segment_size, memory_order_relaxed));
+
+    printf("\"opcodes\":{");
+    for (int i = 0; i < NUM_INSTRUCTIONS; i++)
+        printf("%s\"%s\":%llu", i == 0 ? "" : ",", segment->opcode_names[i],
+               (unsigned long long)get(&segment->opcode_counts[i]));
+    printf("}}\n");
+}
+
+int main(int argc, char **argv)
+{
+    unsigned pid = 0;
+    double interval = 0;
+    int json = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+            interval = atof(argv[++i]);
+        else if (strcmp(argv[i], "-j") == 0)
+            json = 1;
+        else if (pid == 0 && atoi(argv[i]) > 0)
+            pid = atoi(argv[i]);
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+    if (pid == 0)
+    {
+        usage();
+        return 1;
+    }
+
+    const TelemetrySegment *segment = attach(pid);
+    if (segment == NULL)
+    {
+        fprintf(stderr, "Error: Process %u publishes no telemetry.\n", pid);
+        return 1;
+    }
+
+    // The mapping stays valid after the emulator exits, so the final values are printed last.
+    int running;
+    do
+    {
+        running = atomic_load_explicit((_Atomic uint32_t *)&segment->running, memory_order_relaxed);
+        if (json)
+            print_json(segment);
+        else
+            print_table(segment);
+        fflush(stdout);
+
+        if (interval > 0)
+#ifdef _WIN32
+            Sleep((DWORD)(interval * 1000));
+#else
+            usleep((useconds_t)(interval * 1e6));
+#endif
+    } while (interval > 0 && running);
+
+    return 0;
+}